@@ -0,0 +1,95 @@
+#include "AssetCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "Util.h"
+
+struct AssetHeader
+{
+    char magic[8];
+    uint64_t key;
+    uint64_t size;
+    uint64_t contentHash; // catches files cut short by a crash
+};
+
+constexpr char ASSET_MAGIC[8] = "M4KASST";
+
+static std::string assetDirectory;
+
+static std::string assetPath(const uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+
+    return assetDirectory + "/" + name;
+}
+
+void AssetCache::setDirectory(const char* directory)
+{
+    assetDirectory = directory;
+
+    std::error_code error;
+    std::filesystem::create_directories(assetDirectory, error);
+    if (error) {
+        std::cout << "Couldn't create asset cache \"" << assetDirectory << "\": " << error.message() << '\n';
+        assetDirectory.clear();
+    }
+}
+
+bool AssetCache::load(const uint64_t key, std::vector<uint8_t>& data)
+{
+    if (assetDirectory.empty())
+        return false;
+
+    std::ifstream file(assetPath(key), std::ios::binary);
+    if (!file)
+        return false;
+
+    AssetHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!file || memcmp(header.magic, ASSET_MAGIC, sizeof(ASSET_MAGIC)) != 0 || header.key != key)
+        return false;
+
+    data.resize(header.size);
+    file.read(reinterpret_cast<char*>(data.data()), std::streamsize(data.size()));
+
+    return file && hashBytes(data.data(), data.size()) == header.contentHash;
+}
+
+void AssetCache::store(const uint64_t key, const void* data, const size_t size)
+{
+    if (assetDirectory.empty())
+        return;
+
+    AssetHeader header = {};
+    memcpy(header.magic, ASSET_MAGIC, sizeof(ASSET_MAGIC));
+    header.key = key;
+    header.size = size;
+    header.contentHash = hashBytes(data, size);
+
+    // written next to the real name and renamed over it, so readers never see half a file
+    const std::string path = assetPath(key);
+    const std::string temporaryPath = path + ".tmp";
+
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(static_cast<const char*>(data), std::streamsize(size));
+
+        if (!file) {
+            std::cout << "Couldn't write asset cache entry " << temporaryPath << '\n';
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error)
+        std::cout << "Couldn't write asset cache entry " << path << ": " << error.message() << '\n';
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Content addressed blobs on disk: generated textures, shader program binaries.
+// The key is a hash of everything that went into the blob (seeds, source text, defines),
+// so a changed input just misses and stale entries are never read back.
+// Generated chunks have their own cache, see WorldCache
+namespace AssetCache
+{
+    // caching stays off until a directory is set
+    void setDirectory(const char* directory);
+
+    // false on a miss, or if the stored blob is damaged
+    bool load(uint64_t key, std::vector<uint8_t>& data);
+    void store(uint64_t key, const void* data, size_t size);
+}
@@ -0,0 +1,245 @@
+// Headless benchmarks, these don't need a window or an OpenGL context.
+// Usage: Benchmark [name...], runs everything when no names are given
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "Constants.h"
+#include "Pathfinding.h"
+#include "TextureGenerator.h"
+#include "Util.h"
+#include "World.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+static double secondsSince(const BenchClock::time_point start)
+{
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+static void benchmarkTerrain(const char* name, const World::TerrainType terrain)
+{
+    constexpr int runs = 3;
+    constexpr double voxels = double(WORLD_SIZE) * WORLD_SIZE * WORLD_HEIGHT;
+
+    double best = 1e9;
+
+    for (int run = 0; run < runs; run++)
+    {
+        World::generateWorld(18295169L, terrain);
+
+        const BenchClock::time_point start = BenchClock::now();
+
+        for (int chunkZ = 0; chunkZ < CHUNK_COUNT; chunkZ++)
+            for (int chunkX = 0; chunkX < CHUNK_COUNT; chunkX++)
+                World::generateChunk(chunkX, chunkZ);
+
+        const double seconds = secondsSince(start);
+        if (seconds < best)
+            best = seconds;
+    }
+
+    std::cout << "  " << name << ": " << best * 1000.0 << " ms, "
+              << voxels / best / 1e6 << " Mvoxels/s\n";
+}
+
+static void benchmarkWorldGen()
+{
+    std::cout << "World generation (" << WORLD_SIZE << "x" << WORLD_HEIGHT << "x" << WORLD_SIZE << ", single thread, best of 3):\n";
+
+    benchmarkTerrain("heightfield", World::TerrainType::Heightfield);
+    benchmarkTerrain("density    ", World::TerrainType::Density);
+}
+
+// every thread samples its own generator with its own seed
+static void benchmarkNoise()
+{
+    constexpr int samples = 1 << 20;
+
+    const int threadCount = std::max(1, int(std::thread::hardware_concurrency()));
+
+    std::cout << "Noise (" << samples << " 3D samples per thread):\n";
+
+    for (int threads = 1; threads <= threadCount; threads *= 2)
+    {
+        std::vector<std::thread> workers;
+        std::vector<float> sums(threads);
+
+        const BenchClock::time_point start = BenchClock::now();
+
+        for (int t = 0; t < threads; t++)
+        {
+            workers.emplace_back([t, &sums]
+            {
+                const NoiseGenerator noise = NoiseGenerator(18295169L + t);
+
+                float sum = 0;
+                for (int i = 0; i < samples; i++)
+                    sum += noise.noise(float(i & 1023) / 32.f, float(i >> 10 & 63) / 16.f, float(i >> 16) / 32.f);
+
+                sums[t] = sum; // keeps the loop from being optimized out
+            });
+        }
+
+        for (std::thread& worker : workers)
+            worker.join();
+
+        const double seconds = secondsSince(start);
+
+        std::cout << "  " << threads << " thread(s): " << double(samples) * threads / seconds / 1e6 << " Msamples/s\n";
+    }
+}
+
+static glm::ivec3 randomSurface(Random& rand)
+{
+    glm::ivec3 pos;
+    while (!Pathfinding::findSurface(rand.nextInt(WORLD_SIZE), rand.nextInt(WORLD_SIZE), pos)) {}
+
+    return pos;
+}
+
+// random queries between standing cells anywhere in the world, so most paths cross it
+static void benchmarkPathfinding()
+{
+    constexpr int queries = 1000;
+    constexpr double targetMs = 1.0; // a query has to fit comfortably in a frame
+
+    World::generateWorld(18295169L);
+    for (int chunkZ = 0; chunkZ < CHUNK_COUNT; chunkZ++)
+        for (int chunkX = 0; chunkX < CHUNK_COUNT; chunkX++)
+            World::generateChunk(chunkX, chunkZ);
+
+    std::cout << "Pathfinding (" << WORLD_SIZE << "x" << WORLD_SIZE << ", " << queries << " random queries):\n";
+
+    BenchClock::time_point start = BenchClock::now();
+    Pathfinding::buildAllGraphs();
+    std::cout << "  building every chunk graph: " << secondsSince(start) * 1000.0 << " ms\n";
+
+    Random rand = Random(1234);
+    std::vector<glm::ivec3> path;
+    std::vector<double> times;
+
+    int found = 0;
+    size_t totalLength = 0;
+
+    for (int i = 0; i < queries; i++)
+    {
+        const glm::ivec3 from = randomSurface(rand);
+        const glm::ivec3 to = randomSurface(rand);
+
+        start = BenchClock::now();
+        const bool reached = Pathfinding::findPath(from, to, path);
+        times.push_back(secondsSince(start) * 1000.0);
+
+        if (reached) {
+            found++;
+            totalLength += path.size();
+        }
+    }
+
+    std::sort(times.begin(), times.end());
+
+    double total = 0;
+    for (const double time : times)
+        total += time;
+
+    std::cout << "  " << found << " paths found, " << (found ? totalLength / found : 0) << " cells long on average\n"
+              << "  mean " << total / queries << " ms, median " << times[queries / 2] << " ms, 99th percentile "
+              << times[queries * 99 / 100] << " ms, worst " << times.back() << " ms\n"
+              << "  target " << targetMs << " ms: mean " << (total / queries < targetMs ? "met" : "MISSED") << ", 99th percentile "
+              << (times[queries * 99 / 100] < targetMs ? "met" : "MISSED") << "\n";
+
+    // A block over the walker's head only rebuilds its chunk. A wall along a chunk border closes its portals,
+    // so the portal graph gets rebuilt too and the landmarks are measured again over the next few queries
+    for (const bool wall : { false, true })
+    {
+        const glm::ivec3 from = randomSurface(rand);
+        const glm::ivec3 to = randomSurface(rand);
+
+        Pathfinding::findPath(from, to, path);
+
+        if (!wall)
+            World::setBlock(from.x, from.y - 2, from.z, BLOCK_BRICKS);
+
+        for (int z = from.z / CHUNK_SIZE * CHUNK_SIZE; wall && z < (from.z / CHUNK_SIZE + 1) * CHUNK_SIZE; z++)
+        {
+            glm::ivec3 surface;
+            if (!Pathfinding::findSurface(from.x / CHUNK_SIZE * CHUNK_SIZE + CHUNK_SIZE - 1, z, surface))
+                continue;
+
+            for (int y = std::max(surface.y - 2, 0); y <= surface.y; y++)
+                World::setBlock(surface.x, y, z, BLOCK_BRICKS);
+        }
+
+        start = BenchClock::now();
+        Pathfinding::findPath(from, to, path);
+        std::cout << "  query after " << (wall ? "a wall along a chunk border" : "a setBlock overhead") << ": " << secondsSince(start) * 1000.0 << " ms";
+
+        double slowest = 0;
+        for (int i = 0; i < 20; i++)
+        {
+            const glm::ivec3 nextFrom = randomSurface(rand);
+            const glm::ivec3 nextTo = randomSurface(rand);
+
+            start = BenchClock::now();
+            Pathfinding::findPath(nextFrom, nextTo, path);
+            slowest = std::max(slowest, secondsSince(start) * 1000.0);
+        }
+        std::cout << ", slowest of the 20 queries after it: " << slowest << " ms\n";
+    }
+}
+
+static void benchmarkTextures()
+{
+    constexpr int runs = 5;
+
+    std::cout << "Texture atlas (best of " << runs << "):\n";
+
+    std::vector<int> atlas;
+
+    for (int resolution = TEXTURE_RES; resolution <= MAX_TEXTURE_RES; resolution *= 2)
+    {
+        double best = 1e9;
+
+        for (int run = 0; run < runs; run++)
+        {
+            const BenchClock::time_point start = BenchClock::now();
+            buildTextureAtlas(DEFAULT_TEXTURE_SEED, resolution, atlas);
+            best = std::min(best, secondsSince(start));
+        }
+
+        std::cout << "  " << resolution << "px: " << best * 1000.0 << " ms\n";
+    }
+}
+
+struct Benchmark
+{
+    const char* name;
+    void (*run)();
+};
+
+constexpr Benchmark benchmarks[] = {
+    { "worldgen", benchmarkWorldGen },
+    { "noise", benchmarkNoise },
+    { "pathfinding", benchmarkPathfinding },
+    { "textures", benchmarkTextures },
+};
+
+int main(const int argc, const char** argv)
+{
+    for (const Benchmark& benchmark : benchmarks)
+    {
+        bool selected = argc <= 1;
+        for (int i = 1; i < argc; i++)
+            selected |= strcmp(argv[i], benchmark.name) == 0;
+
+        if (selected)
+            benchmark.run();
+    }
+
+    return 0;
+}
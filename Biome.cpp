@@ -0,0 +1,61 @@
+#include "Biome.h"
+
+#include "Util.h"
+
+//                                 name         surface      subsurface          trees  height
+const Biome Biomes::Plains    = { "plains",    BLOCK_GRASS, BLOCK_DEFAULT_DIRT, 8,     0.6f };
+const Biome Biomes::Forest    = { "forest",    BLOCK_GRASS, BLOCK_DEFAULT_DIRT, 2,     1.0f };
+const Biome Biomes::Highlands = { "highlands", BLOCK_STONE, BLOCK_STONE,        0,     2.2f };
+const Biome Biomes::Badlands  = { "badlands",  BLOCK_DEFAULT_DIRT, BLOCK_DEFAULT_DIRT, 0, 0.8f };
+
+const Biome& classifyBiome(const float temperature, const float humidity)
+{
+    if (temperature < 0.35f)
+        return Biomes::Highlands;
+
+    if (humidity > 0.52f)
+        return Biomes::Forest;
+
+    if (temperature > 0.55f && humidity < 0.45f)
+        return Biomes::Badlands;
+
+    return Biomes::Plains;
+}
+
+void ClimateMap::generate(const int chunkX, const int chunkZ, const NoiseGenerator& noise)
+{
+    for (int cx = 0; cx < CLIMATE_POINTS; cx++) {
+        for (int cz = 0; cz < CLIMATE_POINTS; cz++) {
+            const float x = float(chunkX * CHUNK_SIZE + cx * CLIMATE_STEP);
+            const float z = float(chunkZ * CHUNK_SIZE + cz * CLIMATE_STEP);
+
+            // very low frequency, offset so the two fields don't line up
+            temperature[cx][cz] = noise.noise(x / 128.f + 300.f, z / 128.f);
+            humidity[cx][cz] = noise.noise(x / 128.f, z / 128.f + 300.f);
+
+            heightScale[cx][cz] = classifyBiome(temperature[cx][cz], humidity[cx][cz]).heightScale;
+        }
+    }
+}
+
+static float interpolate(const float (&grid)[CLIMATE_POINTS][CLIMATE_POINTS], const int x, const int z)
+{
+    const int cx = x / CLIMATE_STEP;
+    const int cz = z / CLIMATE_STEP;
+
+    const float fx = float(x % CLIMATE_STEP) / CLIMATE_STEP;
+    const float fz = float(z % CLIMATE_STEP) / CLIMATE_STEP;
+
+    return glm::mix(glm::mix(grid[cx][cz],     grid[cx + 1][cz],     fx),
+                    glm::mix(grid[cx][cz + 1], grid[cx + 1][cz + 1], fx), fz);
+}
+
+const Biome& ClimateMap::biome(const int x, const int z) const
+{
+    return classifyBiome(interpolate(temperature, x, z), interpolate(humidity, x, z));
+}
+
+float ClimateMap::heightScaleAt(const int x, const int z) const
+{
+    return interpolate(heightScale, x, z);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+
+#include "Constants.h"
+
+class NoiseGenerator;
+
+// Biomes pick the surface blocks, tree density and height scale of the terrain
+struct Biome
+{
+    const char* name;
+
+    uint8_t surfaceBlock;
+    uint8_t subsurfaceBlock;
+
+    int treeChance; // a tree cell grows a tree 1 in treeChance times, 0 for never
+
+    float heightScale; // multiplies the amplitude of the terrain noise
+};
+
+namespace Biomes
+{
+    extern const Biome Plains;
+    extern const Biome Forest;
+    extern const Biome Highlands;
+    extern const Biome Badlands;
+}
+
+const Biome& classifyBiome(float temperature, float humidity);
+
+// climate is sampled every CLIMATE_STEP blocks, the far chunk edge included so columns can interpolate
+constexpr int CLIMATE_STEP = 4;
+constexpr int CLIMATE_POINTS = CHUNK_SIZE / CLIMATE_STEP + 1;
+
+// Temperature and humidity of one chunk. Built once per chunk and seed, then every pass
+// looks columns up here instead of sampling noise again
+struct ClimateMap
+{
+    float temperature[CLIMATE_POINTS][CLIMATE_POINTS];
+    float humidity[CLIMATE_POINTS][CLIMATE_POINTS];
+
+    // height scale of the biome at each sample, interpolated so that biome borders don't turn into cliffs
+    float heightScale[CLIMATE_POINTS][CLIMATE_POINTS];
+
+    void generate(int chunkX, int chunkZ, const NoiseGenerator& noise);
+
+    // x and z are relative to the chunk
+    const Biome& biome(int x, int z) const;
+    float heightScaleAt(int x, int z) const;
+};
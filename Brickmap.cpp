@@ -0,0 +1,549 @@
+#include "Brickmap.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "World.h"
+
+constexpr int CELL_COUNT = Brickmap::GRID_X * Brickmap::GRID_Y * Brickmap::GRID_Z;
+constexpr int CHUNK_CELLS = CHUNK_SIZE / Brickmap::BRICK_SIZE; // per axis
+
+constexpr int WINDOW = Brickmap::WINDOW_CELLS;
+constexpr int WINDOW_CELL_COUNT = WINDOW * Brickmap::GRID_Y * WINDOW;
+
+static_assert(CHUNK_SIZE % Brickmap::BRICK_SIZE == 0 && WORLD_HEIGHT % Brickmap::BRICK_SIZE == 0, "cells can't straddle chunks");
+
+// a cell with more than one kind of block, those need a brick
+constexpr uint8_t MIXED = 0xFF;
+
+struct Cell
+{
+    uint8_t block = BLOCK_AIR; // the block filling the whole cell, or MIXED
+    bool stale = false;        // resident, but the blocks changed since the upload
+    int32_t slot = -1;         // atlas slot while resident
+    int32_t terrainBrick = -1; // the GPU terrain's blocks of a mixed cell whose chunk isn't handed over yet
+};
+
+static GLuint gridTexture = 0;
+static GLuint atlasTexture = 0;
+static int atlasLayers = 0;
+
+static std::vector<Cell> cells(CELL_COUNT);
+static std::vector<uint32_t> grid(WINDOW_CELL_COUNT); // what the GPU grid holds, toroidally
+static std::vector<uint8_t> rowDirty(WINDOW);          // grid rows along z changed since the upload
+
+// the window's first cell in x and z, nothing is in it until the first update
+static glm::ivec2 windowOrigin(0);
+static bool windowValid = false;
+
+static std::vector<int32_t> freeSlots;
+
+// mixed cells nearest to the player first, at most capacity() of them
+static std::vector<int> wanted;
+static std::vector<uint8_t> isWanted(CELL_COUNT);
+static bool residencyDirty = true;
+static bool uploadsPending = false;
+static glm::ivec3 lastCenterCell(-1);
+
+// The GPU terrain of chunks that haven't been handed over, only the bricks of mixed cells are kept.
+// Uniform cells are just their block
+static std::vector<uint8_t> terrainBricks;
+static std::vector<int32_t> freeTerrainBricks;
+static std::vector<uint8_t> chunkReady(CHUNK_COUNT * CHUNK_COUNT);
+
+static int cellIndex(const int x, const int y, const int z)
+{
+    return x + y * Brickmap::GRID_X + z * Brickmap::GRID_X * Brickmap::GRID_Y;
+}
+
+static glm::ivec3 cellPosition(const int index)
+{
+    return glm::ivec3(index % Brickmap::GRID_X, index / Brickmap::GRID_X % Brickmap::GRID_Y, index / (Brickmap::GRID_X * Brickmap::GRID_Y));
+}
+
+// floored, so cells left of the world wrap around too
+static int wrap(const int cell)
+{
+    return (cell % WINDOW + WINDOW) % WINDOW;
+}
+
+static int gridIndex(const int x, const int y, const int z)
+{
+    return wrap(x) + y * WINDOW + wrap(z) * WINDOW * Brickmap::GRID_Y;
+}
+
+static bool inWindow(const glm::ivec3& cell)
+{
+    return windowValid
+        && cell.x >= windowOrigin.x && cell.x < windowOrigin.x + WINDOW
+        && cell.z >= windowOrigin.y && cell.z < windowOrigin.y + WINDOW;
+}
+
+static uint32_t gridValue(const Cell& cell)
+{
+    if (cell.slot >= 0)
+        return Brickmap::BRICK_RESIDENT | uint32_t(cell.slot);
+
+    // mixed cells that aren't resident trace as air
+    return cell.block == MIXED ? BLOCK_AIR : cell.block;
+}
+
+static void setGrid(const int index)
+{
+    const glm::ivec3 cell = cellPosition(index);
+    if (!inWindow(cell))
+        return;
+
+    grid[gridIndex(cell.x, cell.y, cell.z)] = gridValue(cells[index]);
+    rowDirty[wrap(cell.z)] = 1;
+}
+
+// refills a cell of the window from the CPU side, past the edge of the world is air
+static void exposeCell(const int x, const int y, const int z)
+{
+    const bool inside = x >= 0 && x < Brickmap::GRID_X && z >= 0 && z < Brickmap::GRID_Z;
+
+    grid[gridIndex(x, y, z)] = inside ? gridValue(cells[cellIndex(x, y, z)]) : BLOCK_AIR;
+}
+
+// points the unpack state at the grid mirror, or back to the defaults everything else uploads with
+static void unpackGrid(const bool mirror)
+{
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, mirror ? WINDOW : 0);
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, mirror ? Brickmap::GRID_Y : 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_IMAGES, 0);
+}
+
+// uploads a box of columns from the mirror, in grid texture coordinates, split where it wraps around.
+// Needs unpackGrid(true)
+static void uploadGrid(const int x, const int width, const int z, const int depth)
+{
+    if (x + width > WINDOW) {
+        uploadGrid(x, WINDOW - x, z, depth);
+        uploadGrid(0, x + width - WINDOW, z, depth);
+        return;
+    }
+
+    if (z + depth > WINDOW) {
+        uploadGrid(x, width, z, WINDOW - z);
+        uploadGrid(x, width, 0, z + depth - WINDOW);
+        return;
+    }
+
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+    glPixelStorei(GL_UNPACK_SKIP_IMAGES, z);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, x, 0, z, width, Brickmap::GRID_Y, depth, GL_RED_INTEGER, GL_UNSIGNED_INT, grid.data());
+}
+
+// moves the window to start at origin. Only the slabs of cells it newly covers are refilled and uploaded,
+// unless it jumped further than its own size
+static void scrollWindow(const glm::ivec2& origin)
+{
+    const glm::ivec2 shift = origin - windowOrigin;
+    const bool jumped = !windowValid || std::abs(shift.x) >= WINDOW || std::abs(shift.y) >= WINDOW;
+
+    windowOrigin = origin;
+    windowValid = true;
+
+    if (jumped) {
+        for (int z = origin.y; z < origin.y + WINDOW; z++)
+            for (int y = 0; y < Brickmap::GRID_Y; y++)
+                for (int x = origin.x; x < origin.x + WINDOW; x++)
+                    exposeCell(x, y, z);
+
+        uploadGrid(0, WINDOW, 0, WINDOW);
+        std::fill(rowDirty.begin(), rowDirty.end(), 0);
+        return;
+    }
+
+    // the columns that came in along x, all the way through the window in z
+    if (shift.x != 0) {
+        const int first = shift.x > 0 ? origin.x + WINDOW - shift.x : origin.x;
+
+        for (int z = origin.y; z < origin.y + WINDOW; z++)
+            for (int y = 0; y < Brickmap::GRID_Y; y++)
+                for (int x = first; x < first + std::abs(shift.x); x++)
+                    exposeCell(x, y, z);
+
+        uploadGrid(wrap(first), std::abs(shift.x), 0, WINDOW);
+    }
+
+    // then the rows that came in along z, the corner they share with the columns gets written twice
+    if (shift.y != 0) {
+        const int first = shift.y > 0 ? origin.y + WINDOW - shift.y : origin.y;
+
+        for (int z = first; z < first + std::abs(shift.y); z++)
+            for (int y = 0; y < Brickmap::GRID_Y; y++)
+                for (int x = origin.x; x < origin.x + WINDOW; x++)
+                    exposeCell(x, y, z);
+
+        uploadGrid(0, WINDOW, wrap(first), std::abs(shift.y));
+    }
+}
+
+// a cell's blocks in the atlas layout, x then y / 2 then z, two blocks per byte with the even y in the low 4 bits
+static void gatherBrick(const int index, uint8_t* brick)
+{
+    constexpr int size = Brickmap::BRICK_SIZE;
+
+    const glm::ivec3 origin = cellPosition(index) * size;
+    const Cell& cell = cells[index];
+
+    if (!chunkReady[origin.x / CHUNK_SIZE + origin.z / CHUNK_SIZE * CHUNK_COUNT]) {
+        if (cell.terrainBrick >= 0)
+            memcpy(brick, terrainBricks.data() + size_t(cell.terrainBrick) * Brickmap::BRICK_BYTES, Brickmap::BRICK_BYTES);
+        else
+            memset(brick, cell.block == MIXED ? BLOCK_AIR : cell.block | cell.block << 4, Brickmap::BRICK_BYTES);
+
+        return;
+    }
+
+    for (int z = 0; z < size; z++) {
+        for (int y = 0; y < size; y += 2) {
+            uint8_t* row = brick + (y / 2) * size + z * size * (size / 2);
+
+            const uint8_t* even = World::world + origin.x + (origin.y + y) * WORLD_SIZE + size_t(origin.z + z) * WORLD_SIZE * WORLD_HEIGHT;
+            const uint8_t* odd = even + WORLD_SIZE;
+
+            for (int x = 0; x < size; x++)
+                row[x] = uint8_t(even[x] | odd[x] << 4);
+        }
+    }
+}
+
+static void releaseTerrainBrick(Cell& cell)
+{
+    if (cell.terrainBrick >= 0) {
+        freeTerrainBricks.push_back(cell.terrainBrick);
+        cell.terrainBrick = -1;
+    }
+}
+
+// keeps a mixed cell's GPU terrain until its chunk is handed over
+static void storeTerrainBrick(Cell& cell, const uint8_t* brick)
+{
+    if (cell.terrainBrick < 0) {
+        if (freeTerrainBricks.empty()) {
+            cell.terrainBrick = int32_t(terrainBricks.size() / Brickmap::BRICK_BYTES);
+            terrainBricks.resize(terrainBricks.size() + Brickmap::BRICK_BYTES);
+        }
+        else {
+            cell.terrainBrick = freeTerrainBricks.back();
+            freeTerrainBricks.pop_back();
+        }
+    }
+
+    memcpy(terrainBricks.data() + size_t(cell.terrainBrick) * Brickmap::BRICK_BYTES, brick, Brickmap::BRICK_BYTES);
+}
+
+// sorts a cell by its blocks, evicting or refreshing its brick if it has one
+static void classifyBrick(const int index, const uint8_t* brick)
+{
+    // uniform if every byte is the same pair of one block
+    uint8_t block = (brick[0] & 15) == (brick[0] >> 4) ? brick[0] & 15 : MIXED;
+    for (size_t i = 1; i < Brickmap::BRICK_BYTES && block != MIXED; i++)
+        if (brick[i] != brick[0])
+            block = MIXED;
+
+    Cell& cell = cells[index];
+    const bool wasMixed = cell.block == MIXED;
+    cell.block = block;
+
+    if (cell.slot >= 0) {
+        if (block == MIXED) {
+            cell.stale = true;
+            uploadsPending = true;
+        }
+        else {
+            freeSlots.push_back(cell.slot);
+            cell.slot = -1;
+            cell.stale = false;
+        }
+    }
+
+    if (wasMixed != (block == MIXED))
+        residencyDirty = true;
+
+    setGrid(index);
+}
+
+static void classifyCell(const int index)
+{
+    uint8_t brick[Brickmap::BRICK_BYTES];
+    gatherBrick(index, brick);
+
+    classifyBrick(index, brick);
+}
+
+static void uploadBrick(const int index)
+{
+    uint8_t brick[Brickmap::BRICK_BYTES];
+    gatherBrick(index, brick);
+
+    const int slot = cells[index].slot;
+    const int x = slot % Brickmap::ATLAS_BRICKS_X;
+    const int z = slot / Brickmap::ATLAS_BRICKS_X % Brickmap::ATLAS_BRICKS_Z;
+    const int y = slot / (Brickmap::ATLAS_BRICKS_X * Brickmap::ATLAS_BRICKS_Z);
+
+    glTexSubImage3D(GL_TEXTURE_3D, 0,
+        x * Brickmap::BRICK_SIZE, y * (Brickmap::BRICK_SIZE / 2), z * Brickmap::BRICK_SIZE,
+        Brickmap::BRICK_SIZE, Brickmap::BRICK_SIZE / 2, Brickmap::BRICK_SIZE,
+        GL_RED_INTEGER, GL_UNSIGNED_BYTE, brick);
+
+    cells[index].stale = false;
+}
+
+// picks the cells in the window that should be resident and evicts everything else
+static void updateWanted(const glm::vec3& center)
+{
+    static std::vector<std::pair<float, int>> mixed;
+    static std::vector<int> previous;
+
+    mixed.clear();
+    for (int z = std::max(windowOrigin.y, 0); z < std::min(windowOrigin.y + WINDOW, Brickmap::GRID_Z); z++) {
+        for (int y = 0; y < Brickmap::GRID_Y; y++) {
+            for (int x = std::max(windowOrigin.x, 0); x < std::min(windowOrigin.x + WINDOW, Brickmap::GRID_X); x++) {
+                const int index = cellIndex(x, y, z);
+
+                if (cells[index].block == MIXED) {
+                    const glm::vec3 offset = (glm::vec3(x, y, z) + 0.5f) * float(Brickmap::BRICK_SIZE) - center;
+                    mixed.emplace_back(glm::dot(offset, offset), index);
+                }
+            }
+        }
+    }
+
+    if (int(mixed.size()) > Brickmap::capacity()) {
+        std::nth_element(mixed.begin(), mixed.begin() + Brickmap::capacity(), mixed.end());
+        mixed.resize(Brickmap::capacity());
+    }
+
+    std::sort(mixed.begin(), mixed.end());
+
+    // every resident cell was wanted last time, so only those can need evicting
+    previous.swap(wanted);
+    for (const int index : previous)
+        isWanted[index] = 0;
+
+    wanted.clear();
+    for (const std::pair<float, int>& cell : mixed) {
+        wanted.push_back(cell.second);
+        isWanted[cell.second] = 1;
+    }
+
+    for (const int index : previous) {
+        Cell& cell = cells[index];
+
+        if (cell.slot >= 0 && !isWanted[index]) {
+            freeSlots.push_back(cell.slot);
+            cell.slot = -1;
+            cell.stale = false;
+            setGrid(index);
+        }
+    }
+
+    uploadsPending = true;
+}
+
+void Brickmap::init(const size_t budgetBytes)
+{
+    GLint maxSize = 2048;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxSize);
+
+    const size_t layerBytes = BRICK_BYTES * ATLAS_BRICKS_X * ATLAS_BRICKS_Z;
+    atlasLayers = int(std::max<size_t>(1, std::min<size_t>(budgetBytes / layerBytes, maxSize / (BRICK_SIZE / 2))));
+
+    glGenTextures(1, &gridTexture);
+    glBindTexture(GL_TEXTURE_3D, gridTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_R32UI, WINDOW, GRID_Y, WINDOW);
+
+    glGenTextures(1, &atlasTexture);
+    glBindTexture(GL_TEXTURE_3D, atlasTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_R8UI,
+        ATLAS_BRICKS_X * BRICK_SIZE, atlasLayers * (BRICK_SIZE / 2), ATLAS_BRICKS_Z * BRICK_SIZE);
+
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    // lowest slots first
+    freeSlots.clear();
+    for (int slot = capacity() - 1; slot >= 0; slot--)
+        freeSlots.push_back(slot);
+
+    std::cout << "Brick atlas of " << capacity() << " bricks (" << capacity() * BRICK_BYTES / (1024 * 1024) << " MB) for "
+              << WINDOW_CELL_COUNT << " cells around the player... ";
+}
+
+std::string Brickmap::defines()
+{
+    return "#define ATLAS_BRICKS_X " + std::to_string(ATLAS_BRICKS_X) + "\n"
+         + "#define ATLAS_BRICKS_Z " + std::to_string(ATLAS_BRICKS_Z) + "\n"
+         + "#define BRICK_WINDOW " + std::to_string(WINDOW_CELLS) + "\n";
+}
+
+void Brickmap::resetTerrain()
+{
+    std::fill(chunkReady.begin(), chunkReady.end(), 0);
+
+    for (Cell& cell : cells)
+        cell.terrainBrick = -1;
+
+    terrainBricks.clear();
+    freeTerrainBricks.clear();
+}
+
+void Brickmap::setTerrain(const int chunkX, const int chunkZ, const int chunks, const uint8_t* packed, const int strideY, const int strideZ)
+{
+    constexpr int size = BRICK_SIZE;
+
+    uint8_t brick[BRICK_BYTES];
+
+    for (int z = chunkZ * CHUNK_CELLS; z < std::min(chunkZ + chunks, CHUNK_COUNT) * CHUNK_CELLS; z++) {
+        for (int y = 0; y < GRID_Y; y++) {
+            for (int x = chunkX * CHUNK_CELLS; x < std::min(chunkX + chunks, CHUNK_COUNT) * CHUNK_CELLS; x++) {
+                const int index = cellIndex(x, y, z);
+
+                // the CPU chunk is newer
+                if (chunkReady[x / CHUNK_CELLS + z / CHUNK_CELLS * CHUNK_COUNT])
+                    continue;
+
+                const uint8_t* cellBlocks = packed + (x - chunkX * CHUNK_CELLS) * size + y * (size / 2) * strideY
+                                          + size_t(z - chunkZ * CHUNK_CELLS) * size * strideZ;
+
+                for (int brickZ = 0; brickZ < size; brickZ++)
+                    for (int brickY = 0; brickY < size / 2; brickY++)
+                        memcpy(brick + brickY * size + brickZ * size * (size / 2), cellBlocks + brickY * strideY + size_t(brickZ) * strideZ, size);
+
+                Cell& cell = cells[index];
+                classifyBrick(index, brick);
+
+                if (cell.block == MIXED)
+                    storeTerrainBrick(cell, brick);
+                else
+                    releaseTerrainBrick(cell);
+            }
+        }
+    }
+}
+
+void Brickmap::updateChunk(const int chunkX, const int chunkZ)
+{
+    chunkReady[chunkX + chunkZ * CHUNK_COUNT] = 1;
+
+    for (int z = 0; z < CHUNK_CELLS; z++) {
+        for (int y = 0; y < GRID_Y; y++) {
+            for (int x = 0; x < CHUNK_CELLS; x++) {
+                const int index = cellIndex(chunkX * CHUNK_CELLS + x, y, chunkZ * CHUNK_CELLS + z);
+
+                releaseTerrainBrick(cells[index]);
+                classifyCell(index);
+            }
+        }
+    }
+}
+
+bool Brickmap::update(const glm::vec3& center)
+{
+    const glm::ivec3 centerCell = glm::ivec3(glm::floor(center / float(BRICK_SIZE)));
+    if (centerCell != lastCenterCell) {
+        lastCenterCell = centerCell;
+        residencyDirty = true;
+
+        glBindTexture(GL_TEXTURE_3D, gridTexture);
+        unpackGrid(true);
+        scrollWindow(glm::ivec2(centerCell.x, centerCell.z) - WINDOW / 2);
+        unpackGrid(false);
+    }
+
+    if (residencyDirty) {
+        updateWanted(center);
+        residencyDirty = false;
+    }
+
+    if (uploadsPending) {
+        glBindTexture(GL_TEXTURE_3D, atlasTexture);
+
+        // nearest first, so whatever is left over for the next frames is the furthest away
+        int uploads = 0;
+        for (size_t i = 0; i < wanted.size() && uploads < BRICK_UPLOADS_PER_FRAME; i++) {
+            const int index = wanted[i];
+            Cell& cell = cells[index];
+
+            if (cell.slot < 0) {
+                cell.slot = freeSlots.back();
+                freeSlots.pop_back();
+
+                uploadBrick(index);
+                setGrid(index);
+                uploads++;
+            }
+            else if (cell.stale) {
+                uploadBrick(index);
+                uploads++;
+            }
+        }
+
+        uploadsPending = uploads == BRICK_UPLOADS_PER_FRAME;
+    }
+
+    if (std::find(rowDirty.begin(), rowDirty.end(), 1) != rowDirty.end()) {
+        glBindTexture(GL_TEXTURE_3D, gridTexture);
+        unpackGrid(true);
+
+        // runs of changed rows, full width
+        for (int z = 0; z < WINDOW; z++) {
+            if (!rowDirty[z])
+                continue;
+
+            int end = z;
+            while (end < WINDOW && rowDirty[end])
+                rowDirty[end++] = 0;
+
+            uploadGrid(0, WINDOW, z, end - z);
+            z = end;
+        }
+
+        unpackGrid(false);
+    }
+
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    return uploadsPending;
+}
+
+glm::ivec4 Brickmap::window()
+{
+    return glm::ivec4(windowOrigin, wrap(windowOrigin.x), wrap(windowOrigin.y));
+}
+
+void Brickmap::bind(const bool sampler)
+{
+    if (sampler) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_3D, gridTexture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_3D, atlasTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    else {
+        glBindImageTexture(1, gridTexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI);
+        glBindImageTexture(2, atlasTexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R8UI);
+    }
+}
+
+int Brickmap::residentBricks()
+{
+    return capacity() - int(freeSlots.size());
+}
+
+int Brickmap::capacity()
+{
+    return atlasLayers * ATLAS_BRICKS_X * ATLAS_BRICKS_Z;
+}
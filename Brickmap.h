@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Constants.h"
+
+// The world on the GPU as a two level brickmap. A coarse grid holds one uint per 8^3 cell:
+// either the block the whole cell is made of (air included), or BRICK_RESIDENT plus the slot of the
+// cell's brick in a pooled atlas. Only cells with more than one block need a brick, and only as many
+// fit in the budget are resident, nearest to the player first. Mixed cells that aren't resident trace as air.
+//
+// The grid only covers a window of WINDOW_CELLS x WINDOW_CELLS columns of cells around the player and is
+// addressed toroidally, cell x lives at x mod WINDOW_CELLS. When the player crosses into another cell the
+// window scrolls along and only the slabs of cells it newly covers are rewritten and uploaded, so what the
+// GPU holds and what a frame uploads scale with the render distance and movement, not the world size.
+// Anything outside the window traces as air.
+//
+// Bricks are built from World::world once a chunk is handed over, and from the GPU terrain before that with -gputerrain.
+// They're stored two blocks per texel along y
+namespace Brickmap
+{
+    constexpr int BRICK_SIZE = 8;
+    constexpr uint32_t BRICK_RESIDENT = 0x80000000u;
+
+    constexpr int GRID_X = WORLD_SIZE / BRICK_SIZE;
+    constexpr int GRID_Y = WORLD_HEIGHT / BRICK_SIZE;
+    constexpr int GRID_Z = WORLD_SIZE / BRICK_SIZE;
+
+    // Has to reach past MAX_RENDER_DIST and half of it again on both sides of the player, shadow rays start
+    // at hits up to the render distance away. The player can be anywhere in the centre cell, so one cell less
+    constexpr int WINDOW_CELLS = 62;
+
+    // the atlas is ATLAS_BRICKS_X x ATLAS_BRICKS_Z bricks across, and as many layers of those as the budget allows
+    constexpr int ATLAS_BRICKS_X = 32;
+    constexpr int ATLAS_BRICKS_Z = 32;
+
+    constexpr size_t BRICK_BYTES = size_t(BRICK_SIZE) * (BRICK_SIZE / 2) * BRICK_SIZE;
+
+    // caps the upload hitch when the player moves into a lot of new bricks at once
+    constexpr int BRICK_UPLOADS_PER_FRAME = 1024;
+
+    constexpr int DEFAULT_BUDGET_MB = 4;
+
+    void init(size_t budgetBytes);
+
+    // the atlas layout for raytrace.comp
+    std::string defines();
+
+    // every chunk goes back to the GPU terrain, air until setTerrain covers it
+    void resetTerrain();
+
+    // The GPU terrain of chunks x chunks chunks from (chunkX, chunkZ), two blocks per byte along y like the atlas,
+    // rows of y / 2 strideY bytes apart and slices of z strideZ apart. Chunks that haven't been handed over yet
+    // are built from it. Only the bricks of mixed cells are kept, the volume can go once this returns
+    void setTerrain(int chunkX, int chunkZ, int chunks, const uint8_t* packed, int strideY, int strideZ);
+
+    // rebuilds a chunk's cells from World::world, call once the chunk is generated
+    void updateChunk(int chunkX, int chunkZ);
+
+    // swaps bricks in and out around center and uploads whatever changed.
+    // True while bricks are left over for the next frames
+    bool update(const glm::vec3& center);
+
+    // the window's first cell in x and z, then where that cell sits in the grid texture. raytrace.comp's brickWindow
+    glm::ivec4 window();
+
+    // the grid and atlas on binding 1 and 2, as samplers or as images
+    void bind(bool sampler);
+
+    int residentBricks();
+    int capacity();
+}
@@ -15,7 +15,8 @@ constexpr float RENDER_DIST = 80.0f;
 
 constexpr float PLAYER_REACH = 5.0f;
 
-constexpr int TEXTURE_RES = 16;
+constexpr int TEXTURE_RES = 16; // the original textures, higher resolutions scale this grid
+constexpr int MAX_TEXTURE_RES = 128;
 
 #ifdef CLASSIC
 constexpr int WORLD_SIZE = 64;
@@ -24,6 +25,10 @@ constexpr int WORLD_SIZE = 512;
 #endif
 constexpr int WORLD_HEIGHT = 64;
 
+constexpr int CHUNK_SIZE = 16;
+constexpr int CHUNK_COUNT = WORLD_SIZE / CHUNK_SIZE; // per axis
+constexpr int CHUNK_UPLOADS_PER_FRAME = 64; // caps the upload hitch when a lot of chunks finish at once
+
 constexpr uint8_t BLOCK_AIR = 0;
 constexpr uint8_t BLOCK_GRASS = 1;
 constexpr uint8_t BLOCK_DEFAULT_DIRT = 2;
@@ -33,6 +38,11 @@ constexpr uint8_t BLOCK_WOOD = 7;
 constexpr uint8_t BLOCK_LEAVES = 8;
 constexpr uint8_t BLOCK_MIRROR = 9;
 
+// the GPU world packs two blocks into each texel along y, the even y in the low 4 bits.
+// Block ids have to stay below 16, the texture atlas only holds that many anyway
+constexpr int GPU_WORLD_HEIGHT = WORLD_HEIGHT / 2;
+static_assert(WORLD_HEIGHT % 2 == 0, "blocks are packed in pairs along y");
+
 // COLORS
 
 // S = Sun, A = Amb, Y = skY
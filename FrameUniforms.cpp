@@ -0,0 +1,80 @@
+#include "FrameUniforms.h"
+
+#include <cstring>
+#include <iostream>
+
+// from GL 4.4 / ARB_buffer_storage, glad doesn't have them
+constexpr GLbitfield MAP_PERSISTENT_BIT = 0x0040;
+constexpr GLbitfield MAP_COHERENT_BIT = 0x0080;
+
+typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// a frame that takes longer than this is a driver problem, waiting forever wouldn't help
+constexpr GLuint64 FENCE_TIMEOUT_NS = 1000000000;
+
+static GLuint buffer = 0;
+static GLsizeiptr stride = 0;
+static uint8_t* mapping = nullptr;
+
+static GLsync fences[FrameUniforms::FRAMES_IN_FLIGHT] = {};
+static int current = 0;
+
+void FrameUniforms::init(const GLADloadproc getProcAddress)
+{
+    // every copy has to start on the driver's uniform buffer alignment
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    stride = (GLsizeiptr(sizeof(Frame)) + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+
+    const auto bufferStorage = reinterpret_cast<BufferStorageProc>(getProcAddress("glBufferStorage"));
+    const GLbitfield flags = GL_MAP_WRITE_BIT | MAP_PERSISTENT_BIT | MAP_COHERENT_BIT;
+
+    if (bufferStorage) {
+        bufferStorage(GL_UNIFORM_BUFFER, stride * FRAMES_IN_FLIGHT, nullptr, flags);
+        mapping = static_cast<uint8_t*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, stride * FRAMES_IN_FLIGHT, flags));
+    }
+
+    if (!mapping) {
+        std::cout << "Persistently mapped buffers aren't supported, updating frame uniforms with glBufferSubData\n";
+        glBufferData(GL_UNIFORM_BUFFER, stride * FRAMES_IN_FLIGHT, nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void FrameUniforms::update(const Frame& frame)
+{
+    current = (current + 1) % FRAMES_IN_FLIGHT;
+
+    GLsync& fence = fences[current];
+    if (fence) {
+        const GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+        if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED)
+            std::cout << "Timed out waiting for the GPU to finish with frame uniforms\n";
+
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    const GLintptr offset = stride * current;
+
+    // coherent, so the write is visible to the GPU without a flush
+    if (mapping) {
+        memcpy(mapping + offset, &frame, sizeof(Frame));
+    }
+    else {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(Frame), &frame);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING, buffer, offset, sizeof(Frame));
+}
+
+void FrameUniforms::endFrame()
+{
+    fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
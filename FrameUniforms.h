@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// The raytracer's per-frame values (camera, screen and lighting) as one std140 uniform block.
+// The buffer holds FRAMES_IN_FLIGHT copies and stays mapped, a frame writes the copy the GPU finished
+// with longest ago and binds just that range, so a frame costs a memcpy and one bind instead of a
+// glUniform call per value. A fence per copy keeps the CPU from overwriting one that's still being read
+namespace FrameUniforms
+{
+    constexpr int FRAMES_IN_FLIGHT = 3;
+    constexpr GLuint BINDING = 0;
+
+    // mirrors the Frame block in raytrace.comp, std140 rules, padding spelled out
+    struct Camera
+    {
+        glm::vec3 pos;
+        float cosYaw;
+        float cosPitch;
+        float sinYaw;
+        float sinPitch;
+        float padding0;
+        glm::vec2 frustumDiv;
+        float padding1[2]; // structs round up to 16 bytes
+    };
+
+    struct Frame
+    {
+        Camera camera;
+        glm::vec2 screenSize;
+        float padding0[2];
+        glm::vec3 lightDirection;
+        float padding1;
+        glm::vec3 skyColor;
+        float padding2;
+        glm::vec3 ambColor;
+        float padding3;
+        glm::vec3 sunColor;
+        float padding4;
+        glm::ivec4 brickWindow; // Brickmap::window()
+    };
+
+    static_assert(offsetof(Frame, screenSize) == 48 && offsetof(Frame, lightDirection) == 64
+               && offsetof(Frame, sunColor) == 112 && offsetof(Frame, brickWindow) == 128 && sizeof(Frame) == 144, "Frame has to match std140");
+
+    // glad only goes up to GL 4.3, so glBufferStorage (4.4) comes from the context's own loader.
+    // Without it the copies are updated with glBufferSubData instead of through a mapping
+    void init(GLADloadproc getProcAddress);
+
+    // waits for the oldest copy if the GPU is still reading it, fills it and binds it to BINDING
+    void update(const Frame& frame);
+
+    // call once the frame's last command using the block is issued
+    void endFrame();
+}
@@ -0,0 +1,232 @@
+#include "GpuTerrain.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "Biome.h"
+#include "Constants.h"
+#include "Shader.h"
+#include "Util.h"
+#include "World.h"
+
+// LATTICE_Y in World.cpp
+constexpr int DENSITY_LATTICE_Y = 8;
+
+// every lattice point gets its own invocation
+static_assert((CHUNK_SIZE / CLIMATE_STEP + 1) * (CHUNK_SIZE / CLIMATE_STEP + 1) * (WORLD_HEIGHT / DENSITY_LATTICE_Y + 1) <= CHUNK_SIZE * CHUNK_SIZE,
+              "the density lattice needs more points than a work group has invocations");
+
+static Shader terrainShader;
+static GLuint noiseBuffer = 0;
+static GLuint stagingTexture = 0;
+static GLuint readbackBuffer = 0;
+
+// the batch in flight, signalled once its readback has landed in readbackBuffer
+static GLsync readbackFence = nullptr;
+static int pendingX = 0, pendingZ = 0;
+
+bool GpuTerrain::init()
+{
+    std::stringstream defines;
+    defines << "#define WORLD_SIZE " << WORLD_SIZE << "\n"
+            << "#define WORLD_HEIGHT " << WORLD_HEIGHT << "\n"
+            << "#define CHUNK_SIZE " << CHUNK_SIZE << "\n"
+            << "#define CLIMATE_STEP " << CLIMATE_STEP << "\n"
+            << "#define LATTICE_Y " << DENSITY_LATTICE_Y << "\n"
+            << "#define NOISE_RES " << NoiseGenerator::RES << "\n";
+
+    const std::string definesStr = defines.str();
+
+    // a program that didn't link is deleted and leaves ID at 0, but a driver can also hand back one that didn't
+    terrainShader = Shader("terrain", HasExtra::Yes, definesStr.c_str());
+
+    GLint linked = GL_FALSE;
+    if (terrainShader.ID != 0)
+        glGetProgramiv(terrainShader.ID, GL_LINK_STATUS, &linked);
+
+    if (linked != GL_TRUE) {
+        std::cout << "The GPU terrain shader didn't build, generating terrain on the CPU\n";
+        if (terrainShader.ID != 0)
+            glDeleteProgram(terrainShader.ID);
+        terrainShader = Shader();
+        return false;
+    }
+
+    glGenBuffers(1, &noiseBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, noiseBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * (NoiseGenerator::RES + 1) * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glGenTextures(1, &stagingTexture);
+    glBindTexture(GL_TEXTURE_3D, stagingTexture);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_R8UI, BATCH_SIZE, GPU_WORLD_HEIGHT, BATCH_SIZE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    glGenBuffers(1, &readbackBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, BATCH_BYTES, nullptr, GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    return true;
+}
+
+void GpuTerrain::begin()
+{
+    // a batch of the old seed or parameters is of no use anymore
+    if (readbackFence) {
+        glDeleteSync(readbackFence);
+        readbackFence = nullptr;
+    }
+
+    // the tables change with the seed, they're small enough to upload every time
+    constexpr GLsizeiptr tableBytes = (NoiseGenerator::RES + 1) * sizeof(float);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, noiseBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, tableBytes, World::getTerrainNoise().values());
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, tableBytes, tableBytes, World::getClimateNoise().values());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    terrainShader.use();
+
+    const World::GenParams& params = World::getParams();
+    terrainShader.setFloat("params.maxTerrainHeight", params.maxTerrainHeight);
+    terrainShader.setInt("params.stoneDepth", params.stoneDepth);
+    terrainShader.setFloat("params.horizontalScale", params.horizontalScale);
+    terrainShader.setFloat("params.heightAmplitude", params.heightAmplitude);
+    terrainShader.setFloat("params.verticalScale", params.verticalScale);
+    terrainShader.setFloat("params.densityFalloff", params.densityFalloff);
+    terrainShader.setFloat("params.densityAmplitude", params.densityAmplitude);
+    terrainShader.setFloat("params.caveScale", params.caveScale);
+    terrainShader.setFloat("params.caveWidth", params.caveWidth);
+    terrainShader.setFloat("params.caveStrength", params.caveStrength);
+
+    terrainShader.setBool("densityTerrain", World::getTerrainType() == World::TerrainType::Density);
+
+    // same order as classifyBiome in the shader
+    const Biome* biomes[] = { &Biomes::Plains, &Biomes::Forest, &Biomes::Highlands, &Biomes::Badlands };
+    for (int i = 0; i < 4; i++)
+    {
+        const std::string index = "[" + std::to_string(i) + "]";
+        terrainShader.setInt("biomeSurface" + index, biomes[i]->surfaceBlock);
+        terrainShader.setInt("biomeSubsurface" + index, biomes[i]->subsurfaceBlock);
+        terrainShader.setFloat("biomeHeightScale" + index, biomes[i]->heightScale);
+    }
+
+    glUseProgram(0);
+}
+
+void GpuTerrain::dispatch(const int chunkX, const int chunkZ)
+{
+    terrainShader.use();
+    glUniform2i(glGetUniformLocation(terrainShader.ID, "batchOrigin"), chunkX, chunkZ);
+
+    glBindImageTexture(1, stagingTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R8UI);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, noiseBuffer);
+
+    glDispatchCompute(std::min(BATCH_CHUNKS, CHUNK_COUNT - chunkX), 1, std::min(BATCH_CHUNKS, CHUNK_COUNT - chunkZ));
+
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+    glUseProgram(0);
+
+    // with a pack buffer bound this only queues the copy, the pointer is an offset into the buffer
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffer);
+    glBindTexture(GL_TEXTURE_3D, stagingTexture);
+    glGetTexImage(GL_TEXTURE_3D, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    if (readbackFence)
+        glDeleteSync(readbackFence);
+
+    readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    pendingX = chunkX;
+    pendingZ = chunkZ;
+}
+
+bool GpuTerrain::inFlight()
+{
+    return readbackFence != nullptr;
+}
+
+bool GpuTerrain::poll(int& chunkX, int& chunkZ, std::vector<uint8_t>& packed)
+{
+    if (!readbackFence)
+        return false;
+
+    // flushing makes sure the fence gets to the GPU at all, a timeout of 0 never blocks
+    const GLenum status = glClientWaitSync(readbackFence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+
+    glDeleteSync(readbackFence);
+    readbackFence = nullptr;
+
+    packed.resize(BATCH_BYTES);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffer);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, BATCH_BYTES, GL_MAP_READ_BIT);
+    if (mapped)
+        memcpy(packed.data(), mapped, BATCH_BYTES);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (!mapped)
+        return false;
+
+    chunkX = pendingX;
+    chunkZ = pendingZ;
+    return true;
+}
+
+size_t GpuTerrain::verify(const int chunkX, const int chunkZ, const std::vector<uint8_t>& packed)
+{
+    constexpr int chunkBlocks = CHUNK_SIZE * WORLD_HEIGHT * CHUNK_SIZE;
+
+    // the CPU terrain pass without decoration, one chunk at a time laid out like the world array
+    std::vector<uint8_t> cpuChunk(chunkBlocks);
+    World::ChunkFeatures features;
+
+    size_t mismatches = 0;
+
+    for (int batchZ = 0; batchZ < std::min(BATCH_CHUNKS, CHUNK_COUNT - chunkZ); batchZ++)
+    {
+        for (int batchX = 0; batchX < std::min(BATCH_CHUNKS, CHUNK_COUNT - chunkX); batchX++)
+        {
+            const int originX = (chunkX + batchX) * CHUNK_SIZE;
+            const int originZ = (chunkZ + batchZ) * CHUNK_SIZE;
+
+            const World::ChunkView chunk = { cpuChunk.data(), CHUNK_SIZE, CHUNK_SIZE * WORLD_HEIGHT, originX, originZ };
+            World::generateTerrainInto(chunkX + batchX, chunkZ + batchZ, chunk, features);
+
+            for (int z = 0; z < CHUNK_SIZE; z++)
+                for (int y = 0; y < WORLD_HEIGHT; y++)
+                    for (int x = 0; x < CHUNK_SIZE; x++)
+                    {
+                        const int stagingX = batchX * CHUNK_SIZE + x;
+                        const int stagingZ = batchZ * CHUNK_SIZE + z;
+
+                        const uint8_t pair = packed[stagingX + (y / 2) * BATCH_SIZE + size_t(stagingZ) * BATCH_SIZE * GPU_WORLD_HEIGHT];
+                        const int gpuBlock = (pair >> (y % 2 * 4)) & 15;
+                        const int cpuBlock = cpuChunk[x + y * CHUNK_SIZE + z * CHUNK_SIZE * WORLD_HEIGHT];
+
+                        if (gpuBlock == cpuBlock)
+                            continue;
+
+                        if (mismatches == 0)
+                            std::cout << "GPU and CPU terrain differ at " << glm::vec3(originX + x, y, originZ + z)
+                                      << ": GPU " << gpuBlock << ", CPU " << cpuBlock << '\n';
+
+                        mismatches++;
+                    }
+        }
+    }
+
+    return mismatches;
+}
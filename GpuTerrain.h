@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "Constants.h"
+
+// The terrain pass of the world generator as a compute shader, opt in with -gputerrain. It runs over batches of
+// chunks into a small staging volume, so the world never has to fit on the GPU as a dense volume. The volume is
+// copied into a pixel buffer behind a fence and picked up frames later, so nothing waits for the readback.
+// Trees are still planted on the CPU, decorated chunks replace the GPU terrain as they get handed over
+namespace GpuTerrain
+{
+    // chunks per batch along x and z
+    constexpr int BATCH_CHUNKS = 8;
+    constexpr int BATCH_SIZE = BATCH_CHUNKS * CHUNK_SIZE;
+
+    // bytes of one batch read back, two blocks per byte along y with the even one in the low 4 bits,
+    // laid out x then y / 2 then z over the whole batch
+    constexpr size_t BATCH_BYTES = size_t(BATCH_SIZE) * GPU_WORLD_HEIGHT * BATCH_SIZE;
+
+    // builds res/terrain.comp and the staging volume, false if it doesn't compile or link
+    bool init();
+
+    // uploads the noise tables and parameters of the current seed and drops a batch still in flight,
+    // call before a round of batches
+    void begin();
+
+    // Starts the terrain pass for the batch starting at chunk (chunkX, chunkZ) and its readback.
+    // One batch is in flight at a time. Batches past the edge of the world only fill the part inside it
+    void dispatch(int chunkX, int chunkZ);
+    bool inFlight();
+
+    // Copies the batch into packed once the GPU is done with it, without waiting.
+    // False while it's still running or nothing is in flight
+    bool poll(int& chunkX, int& chunkZ, std::vector<uint8_t>& packed);
+
+    // Compares a batch from poll to the CPU terrain pass, which takes a while.
+    // Float rounding can differ between drivers, so a few blocks on noise thresholds may not match.
+    // Returns the number of blocks that differ
+    size_t verify(int chunkX, int chunkZ, const std::vector<uint8_t>& packed);
+}
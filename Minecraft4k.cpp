@@ -1,5 +1,11 @@
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -8,7 +14,12 @@
 #include "include/glad/glad.h"
 #include <GLFW/glfw3.h>
 
+#include "AssetCache.h"
+#include "Brickmap.h"
 #include "Constants.h"
+#include "FrameUniforms.h"
+#include "GpuTerrain.h"
+#include "RaytraceTuning.h"
 #include "Shader.h"
 #include "TextureGenerator.h"
 #include "Util.h"
@@ -37,13 +48,104 @@ constexpr glm::vec2 defaultRes(214, 120);
 glm::vec2 SCR_RES = defaultRes * float(1 << SCR_DETAIL);
 
 Shader screenShader;
-Shader computeShader;
+ShaderPermutations raytraceShaders;
+
+// formats the raytracer can write. The colour is LDR, narrower formats save bandwidth on every write and every present
+struct ScreenFormat
+{
+    const char* name;
+    GLenum internalFormat;
+    const char* imageFormat; // the matching layout qualifier in raytrace.comp
+};
+
+constexpr ScreenFormat SCREEN_FORMATS[] = {
+    { "RGBA32F", GL_RGBA32F, "rgba32f" },
+    { "RGBA8", GL_RGBA8, "rgba8" },
+    { "RGB10_A2", GL_RGB10_A2, "rgb10_a2" },
+    { "R11G11B10F", GL_R11F_G11F_B10F, "r11f_g11f_b10f" },
+};
+
+constexpr int SCREEN_FORMAT_COUNT = sizeof(SCREEN_FORMATS) / sizeof(SCREEN_FORMATS[0]);
+
+// raytracer features, picked at runtime. Every combination is its own shader variant
+struct RenderMode
+{
+    bool shadows;
+    bool mirrors;
+    bool classicFog;
+    int renderDistance;
+    int screenFormat; // index into SCREEN_FORMATS
+    bool worldSampler; // texelFetch from a usampler3D instead of imageLoad
+    RaytraceTuning::Layout layout; // work group shape and pixel order, autotuned per driver
+};
+
+#ifdef CLASSIC
+RenderMode renderMode = { false, true, true, int(RENDER_DIST), 1, false, RaytraceTuning::DEFAULT_LAYOUT };
+#else
+RenderMode renderMode = { true, true, false, int(RENDER_DIST), 1, false, RaytraceTuning::DEFAULT_LAYOUT };
+#endif
+
+// copy the raytraced image to the window with glBlitFramebuffer instead of drawing the screen quad
+bool blitToScreen = true;
+
+constexpr int MIN_RENDER_DIST = 16;
+constexpr int MAX_RENDER_DIST = 160;
+static_assert(Brickmap::WINDOW_CELLS / 2 * Brickmap::BRICK_SIZE - Brickmap::BRICK_SIZE >= MAX_RENDER_DIST * 3 / 2,
+              "the brick window has to cover the render distance and the shadow rays past it");
+
+// renderMode's variant and its uniforms, both swapped by updateRenderMode
+const Shader* raytraceShader = nullptr;
+
+// the rest comes from the per-frame block, see FrameUniforms
+struct RaytraceUniforms
+{
+    Uniform<int> blockTextures;
+};
+RaytraceUniforms raytraceUniforms;
 GLuint buffer;
 GLuint vao;
 
-GLuint textureAtlasTex;
-GLuint worldTexture;
+GLuint blockTextures;
+
+// pixels per tile side, -textureres picks a multiple of TEXTURE_RES up to MAX_TEXTURE_RES
+int textureRes = TEXTURE_RES;
+
+// -gputerrain: the terrain near the player is generated on the GPU first, the CPU chunks with trees replace it
+// as they finish. -verifyterrain also compares every batch with the CPU terrain
+bool useGpuTerrain = false;
+bool verifyGpuTerrain = false;
 GLuint screenTexture;
+GLuint screenFramebuffer; // reads screenTexture for the blit
+int screenTextureFormat = -1; // index into SCREEN_FORMATS
+
+glm::ivec2 windowSize(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+// GPU time of raytracing and presenting, averaged over a couple of seconds per screen format.
+// The query is only read once its result is in, so measuring never stalls the pipeline
+GLuint frameTimeQuery;
+bool frameTimeQueryPending = false;
+bool frameTimeQueryStale = false; // issued before the mode changed, dropped when it comes back
+double frameTimeTotal = 0;
+int frameTimeCount = 0;
+long long lastFrameTimeReport = 0;
+
+// A sweep times a list of render modes one after another over the next frames, then hands the
+// averages to finish. Hold the camera still while one runs
+struct Sweep
+{
+    std::vector<RenderMode> modes;
+    std::vector<double> results; // ms GPU per frame, one per mode
+    int frames; // timed frames per mode
+    RenderMode restore;
+    void (*finish)(const Sweep& sweep);
+};
+
+Sweep sweep;
+int sweepStep = -1; // the mode being timed, -1 while no sweep runs
+
+// the raytracer layout gets tuned once the world around the spawn is there to trace
+constexpr int TUNING_RADIUS = 4; // in chunks
+bool tuningPending = false;
 
 float deltaTime = 16.666f; // 16.66 = 60fps
 
@@ -136,48 +238,387 @@ void updateScreenResolution(GLFWwindow* window)
     needsResUpdate = false;
 }
 
-void init()
+void updateRenderMode()
 {
-    // generate world
+    std::stringstream defines;
+    defines << "#define RENDER_DIST " << renderMode.renderDistance << "\n"
+            << "#define SCREEN_FORMAT " << SCREEN_FORMATS[renderMode.screenFormat].imageFormat << "\n";
+
+    if (renderMode.shadows)
+        defines << "#define SHADOWS\n";
+    if (renderMode.mirrors)
+        defines << "#define MIRRORS\n";
+    if (renderMode.classicFog)
+        defines << "#define CLASSIC_FOG\n";
+    if (renderMode.worldSampler)
+        defines << "#define WORLD_SAMPLER\n";
+
+    defines << RaytraceTuning::defines(renderMode.layout);
+
+    // builds the variant the first time this mode is used
+    const Shader& shader = raytraceShaders.get(defines.str());
+    raytraceShader = &shader;
+
+    raytraceUniforms.blockTextures = shader.uniform("blockTextures");
+
+    std::cout << "Render mode: shadows " << (renderMode.shadows ? "on" : "off")
+              << ", mirrors " << (renderMode.mirrors ? "on" : "off")
+              << ", " << (renderMode.classicFog ? "classic fog" : "lit")
+              << ", render distance " << renderMode.renderDistance
+              << ", " << SCREEN_FORMATS[renderMode.screenFormat].name << " screen, " << (blitToScreen ? "blit" : "quad")
+              << ", world " << (renderMode.worldSampler ? "texelFetch" : "imageLoad")
+              << ", " << RaytraceTuning::describe(renderMode.layout) << " groups\n";
+
+    // the image qualifier has to match the texture, sweeps can change the format too
+    if (renderMode.screenFormat != screenTextureFormat)
+        needsResUpdate = true;
+
+    // frame times only mean something for one mode at a time
+    frameTimeTotal = 0;
+    frameTimeCount = 0;
+    frameTimeQueryStale = frameTimeQueryPending;
+}
 
-    std::cout << "Generating world... ";
-#ifdef CLASSIC
-    World::generateWorld(18295169L);
-#else
-    World::generateWorld();
-#endif
+void startSweep(std::vector<RenderMode> modes, const int frames, void (*finish)(const Sweep& sweep))
+{
+    if (sweepStep >= 0 || modes.empty())
+        return;
+
+    sweep.modes = std::move(modes);
+    sweep.results.clear();
+    sweep.frames = frames;
+    sweep.restore = renderMode;
+    sweep.finish = finish;
+
+    sweepStep = 0;
+    renderMode = sweep.modes[0];
+    updateRenderMode();
+}
 
-    std::cout << "Done!\n";
+// called whenever frameTimeCount goes up, moves on to the next mode once this one has its frames
+void updateSweep()
+{
+    if (sweepStep < 0 || frameTimeCount < sweep.frames)
+        return;
+
+    sweep.results.push_back(frameTimeTotal / frameTimeCount);
+    sweepStep++;
 
-    std::cout << "Uploading world to GPU... ";
-    glGenTextures(1, &worldTexture);
-    glBindTexture(GL_TEXTURE_3D, worldTexture);
+    if (sweepStep < int(sweep.modes.size())) {
+        renderMode = sweep.modes[sweepStep];
+        updateRenderMode();
+        return;
+    }
 
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    sweepStep = -1;
+    renderMode = sweep.restore;
 
-    glTexStorage3D(GL_TEXTURE_3D,               // target
-        1,                                      // levels
-        GL_R8,                                  // internal format
-        WORLD_SIZE, WORLD_HEIGHT, WORLD_SIZE);  // size
+    // finish may change the mode, it gets applied after
+    sweep.finish(sweep);
+    updateRenderMode();
+}
 
-    glTexSubImage3D(GL_TEXTURE_3D,              // target
-        0,                                      // level
-        0, 0, 0,                                // offsets
-        WORLD_SIZE, WORLD_HEIGHT, WORLD_SIZE,   // size
-        GL_RED,                                 // format
-        GL_UNSIGNED_BYTE,                       // type
-        World::world);                          // pixels
+// F7, times both ways of reading the world
+void startWorldFetchBenchmark()
+{
+    std::cout << "Benchmarking world fetches, hold still...\n";
 
-    glBindTexture(GL_TEXTURE_3D, 0);
+    RenderMode image = renderMode;
+    image.worldSampler = false;
 
-    std::cout << "Done!\n";
+    RenderMode sampler = renderMode;
+    sampler.worldSampler = true;
+
+    startSweep({ image, sampler }, 64, [](const Sweep& sweep)
+    {
+        std::cout << "World fetch benchmark, " << int(SCR_RES.x) << "x" << int(SCR_RES.y) << ", "
+                  << SCREEN_FORMATS[renderMode.screenFormat].name << ", average of " << sweep.frames << " frames:\n"
+                  << "  imageLoad:  " << sweep.results[0] << " ms GPU per frame\n"
+                  << "  texelFetch: " << sweep.results[1] << " ms GPU per frame\n";
+    });
+}
+
+// F8 or the first start on a driver, times every raytracer layout and keeps the fastest
+void startLayoutTuning()
+{
+    std::cout << "Tuning the raytracer for this GPU, hold still...\n";
+
+    std::vector<RenderMode> modes;
+    for (int i = 0; i < RaytraceTuning::CANDIDATE_COUNT; i++) {
+        modes.push_back(renderMode);
+        modes.back().layout = RaytraceTuning::candidate(i);
+    }
+
+    startSweep(modes, 16, [](const Sweep& sweep)
+    {
+        int fastest = 0;
+
+        std::cout << "Raytracer layouts, " << int(SCR_RES.x) << "x" << int(SCR_RES.y) << ", average of " << sweep.frames << " frames:\n";
+        for (size_t i = 0; i < sweep.modes.size(); i++) {
+            std::cout << "  " << RaytraceTuning::describe(sweep.modes[i].layout) << ": " << sweep.results[i] << " ms GPU per frame\n";
+
+            if (sweep.results[i] < sweep.results[fastest])
+                fastest = int(i);
+        }
+
+        renderMode.layout = sweep.modes[fastest].layout;
+        RaytraceTuning::storeCached(renderMode.layout);
+
+        std::cout << "Using " << RaytraceTuning::describe(renderMode.layout) << "\n";
+    });
+}
+
+// the first tuning waits for the chunks around the player, an empty world would time the sky
+void updateLayoutTuning(const bool uploadsPending)
+{
+    if (!tuningPending || sweepStep >= 0 || uploadsPending)
+        return;
+
+    const int playerChunkX = int(playerPos.x) / CHUNK_SIZE;
+    const int playerChunkZ = int(playerPos.z) / CHUNK_SIZE;
+
+    for (int z = std::max(0, playerChunkZ - TUNING_RADIUS); z <= std::min(CHUNK_COUNT - 1, playerChunkZ + TUNING_RADIUS); z++)
+        for (int x = std::max(0, playerChunkX - TUNING_RADIUS); x <= std::min(CHUNK_COUNT - 1, playerChunkX + TUNING_RADIUS); x++)
+            if (!World::isChunkGenerated(x, z))
+                return;
+
+    tuningPending = false;
+    startLayoutTuning();
+}
+
+// generated chunks waiting for their turn to be uploaded
+std::vector<glm::ivec2> pendingChunks;
+
+// true while there are chunks left over for the next frames
+bool uploadGeneratedChunks()
+{
+    // workers finish nearest chunks first, so keep that order when over budget
+    World::takeGeneratedChunks(pendingChunks);
+
+    if (pendingChunks.empty())
+        return false;
+
+    const int uploadCount = std::min(int(pendingChunks.size()), CHUNK_UPLOADS_PER_FRAME);
+
+    // the brickmap sorts the chunk into cells, their bricks go up once they're near enough
+    for (int i = 0; i < uploadCount; i++)
+        Brickmap::updateChunk(pendingChunks[i].x, pendingChunks[i].y);
+
+    pendingChunks.erase(pendingChunks.begin(), pendingChunks.begin() + uploadCount);
+
+    return !pendingChunks.empty();
+}
+
+constexpr const char* worldGenConfig = "res/worldgen.cfg";
+std::filesystem::file_time_type worldGenConfigTime;
+double lastConfigCheck = 0;
+
+static std::filesystem::file_time_type configWriteTime()
+{
+    std::error_code error; // the file may be mid-save, try again next time
+    return std::filesystem::last_write_time(worldGenConfig, error);
+}
+
+// when the world was last started or regenerated, so the log shows how long the chunks
+// around the player took and how many of them the disk cache had
+std::chrono::steady_clock::time_point worldStartTime;
+bool worldReadyReported = false;
+
+static void startWorldTimer()
+{
+    worldStartTime = std::chrono::steady_clock::now();
+    worldReadyReported = false;
+}
+
+// once per start, when nothing in range is missing anymore
+void reportWorldReady(const int missingChunks)
+{
+    if (worldReadyReported || missingChunks > 0)
+        return;
+
+    worldReadyReported = true;
+
+    const World::GenerationStats stats = World::generationStats();
+    std::cout << "World around the player ready in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - worldStartTime).count() << " ms: "
+              << stats.fromCache << " chunks from the disk cache, " << stats.generated << " generated\n";
+}
+
+constexpr const char* worldSeedFile = "cache/world_seed";
+
+// Without a seed argument the game goes back to the world it made last time, so its chunks come out of
+// the disk cache. A new world only gets rolled the first time or with -newworld, and is remembered in turn
+static uint64_t defaultSeed(const bool newWorld)
+{
+    uint64_t seed;
+
+    if (!newWorld) {
+        std::ifstream file(worldSeedFile);
+        if (file >> seed)
+            return seed;
+    }
+
+    Random rand;
+    seed = rand.nextLong();
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(worldSeedFile).parent_path(), error);
+
+    std::ofstream file(worldSeedFile);
+    file << seed << '\n';
+    if (!file)
+        std::cout << "Couldn't save the seed to " << worldSeedFile << ", the next start gets a new world\n";
+
+    return seed;
+}
+
+constexpr int GPU_TERRAIN_BATCHES = (CHUNK_COUNT + GpuTerrain::BATCH_CHUNKS - 1) / GpuTerrain::BATCH_CHUNKS; // per axis
+
+std::vector<uint8_t> gpuTerrainStarted; // one flag per batch since the last restart
+std::vector<uint8_t> gpuTerrainBatch;
+
+// drops the GPU terrain and streams it again, after the seed or the parameters changed
+void restartGpuTerrain()
+{
+    Brickmap::resetTerrain();
+    GpuTerrain::begin();
+
+    gpuTerrainStarted.assign(GPU_TERRAIN_BATCHES * GPU_TERRAIN_BATCHES, 0);
+}
+
+// Once a frame: hands the batch whose readback has landed to the brickmap, then starts the nearest batch in range
+// that hasn't run yet. Batches the CPU has already finished are skipped, the GPU only fills in what's still missing.
+// True while a batch is in flight
+bool streamGpuTerrain(const glm::vec3& center, const float radius)
+{
+    int chunkX, chunkZ;
+    if (GpuTerrain::poll(chunkX, chunkZ, gpuTerrainBatch)) {
+        if (verifyGpuTerrain) {
+            const size_t batchBlocks = size_t(std::min(GpuTerrain::BATCH_CHUNKS, CHUNK_COUNT - chunkX)) * std::min(GpuTerrain::BATCH_CHUNKS, CHUNK_COUNT - chunkZ)
+                                     * CHUNK_SIZE * WORLD_HEIGHT * CHUNK_SIZE;
+            const size_t mismatches = GpuTerrain::verify(chunkX, chunkZ, gpuTerrainBatch);
+
+            std::cout << "GPU terrain batch at chunk " << chunkX << ", " << chunkZ << ": ";
+            if (mismatches == 0)
+                std::cout << "matches the CPU terrain\n";
+            else
+                std::cout << mismatches << " of " << batchBlocks << " blocks (" << 100.0 * mismatches / batchBlocks << "%) differ\n";
+        }
+
+        Brickmap::setTerrain(chunkX, chunkZ, GpuTerrain::BATCH_CHUNKS, gpuTerrainBatch.data(),
+            GpuTerrain::BATCH_SIZE, GpuTerrain::BATCH_SIZE * GPU_WORLD_HEIGHT);
+    }
+
+    if (GpuTerrain::inFlight())
+        return true;
+
+    int nearest = -1;
+    float nearestDistance = radius;
+
+    for (int batchZ = 0; batchZ < GPU_TERRAIN_BATCHES; batchZ++) {
+        for (int batchX = 0; batchX < GPU_TERRAIN_BATCHES; batchX++) {
+            const int batch = batchX + batchZ * GPU_TERRAIN_BATCHES;
+            if (gpuTerrainStarted[batch])
+                continue;
+
+            const glm::vec2 closest = glm::clamp(glm::vec2(center.x, center.z),
+                                                 glm::vec2(batchX, batchZ) * float(GpuTerrain::BATCH_SIZE),
+                                                 glm::vec2(batchX + 1, batchZ + 1) * float(GpuTerrain::BATCH_SIZE));
+            const float distance = glm::distance(closest, glm::vec2(center.x, center.z));
+            if (distance > nearestDistance)
+                continue;
+
+            bool generated = !verifyGpuTerrain;
+            for (int z = batchZ * GpuTerrain::BATCH_CHUNKS; z < std::min((batchZ + 1) * GpuTerrain::BATCH_CHUNKS, CHUNK_COUNT) && generated; z++)
+                for (int x = batchX * GpuTerrain::BATCH_CHUNKS; x < std::min((batchX + 1) * GpuTerrain::BATCH_CHUNKS, CHUNK_COUNT) && generated; x++)
+                    generated = World::isChunkGenerated(x, z);
+
+            if (generated) {
+                gpuTerrainStarted[batch] = 1;
+                continue;
+            }
+
+            nearest = batch;
+            nearestDistance = distance;
+        }
+    }
+
+    if (nearest < 0)
+        return false;
+
+    gpuTerrainStarted[nearest] = 1;
+    GpuTerrain::dispatch(nearest % GPU_TERRAIN_BATCHES * GpuTerrain::BATCH_CHUNKS, nearest / GPU_TERRAIN_BATCHES * GpuTerrain::BATCH_CHUNKS);
+
+    return true;
+}
+
+// poll the worldgen config twice a second, when it changes regenerate the world around the player
+void reloadWorldGenConfig()
+{
+    const double now = glfwGetTime();
+    if (now - lastConfigCheck < 0.5)
+        return;
+
+    lastConfigCheck = now;
+
+    const std::filesystem::file_time_type writeTime = configWriteTime();
+    if (writeTime == worldGenConfigTime)
+        return;
+
+    worldGenConfigTime = writeTime;
+
+    World::GenParams params;
+    if (!World::loadParams(worldGenConfig, params))
+        return;
+
+    std::cout << "Reloading " << worldGenConfig << '\n';
+    startWorldTimer();
+
+    // the workers read the parameters, so they have to be stopped while they change.
+    // Old blocks stay visible until the new chunks replace them, nearest first
+    World::stopGenerationThreads();
+    World::setParams(params);
+
+    // those were generated with the old parameters and the workers are about to regenerate them in place
+    pendingChunks.clear();
+
+    if (useGpuTerrain)
+        restartGpuTerrain();
+
+    World::startGenerationThreads(std::max(1, int(std::thread::hardware_concurrency()) - 1));
+}
+
+void init(const char* seedArg, const bool newWorld)
+{
+    World::GenParams params;
+    if (World::loadParams(worldGenConfig, params))
+        World::setParams(params);
+    else
+        std::cout << "Couldn't read " << worldGenConfig << ", using the default worldgen parameters\n";
+
+    worldGenConfigTime = configWriteTime();
+
+    // chunks are generated in the background while the game runs, this only picks the seed.
+    // Every seed keeps its chunks in the disk cache, so the next start with that seed skips worldgen
+    World::enableDiskCache("cache");
+    startWorldTimer();
+
+#ifdef CLASSIC
+    World::generateWorld(18295169L);
+#else
+    const uint64_t seed = seedArg ? std::strtoull(seedArg, nullptr, 10) : defaultSeed(newWorld);
+    std::cout << "World seed " << seed << '\n';
+    World::generateWorld(seed);
+#endif
+
+    // leave a core for the game loop
+    World::startGenerationThreads(std::max(1, int(std::thread::hardware_concurrency()) - 1));
+
+    if (useGpuTerrain)
+        restartGpuTerrain();
 
     std::cout << "Generating textures... ";
-    textureAtlasTex = generateTextures(151910774187927L);
+    blockTextures = generateTextures(DEFAULT_TEXTURE_SEED, textureRes);
 
     std::cout << "Finished initializing engine! Onto the game.\n";
 }
@@ -290,14 +731,25 @@ void run(GLFWwindow* window) {
                 int magicY = int(playerPos.y + ((colliderIndex >> 2) - 1) * 0.8F + 0.65F);
                 int magicZ = int(playerPos.z + (colliderIndex >> 1 & 1) * 0.6F - 0.3F);
 
-                // set block to air if inside player
-                if (World::isWithinWorld(glm::vec3(magicX, magicY, magicZ)))
+                // set block to air if inside player, cells that already are stay untouched
+                if (World::isWithinWorld(glm::vec3(magicX, magicY, magicZ)) && World::getBlock(magicX, magicY, magicZ) != BLOCK_AIR)
                     World::setBlock(magicX, magicY, magicZ, BLOCK_AIR);
             }
 
             lastUpdateTime += 10;
         }
 
+        reloadWorldGenConfig();
+
+        // shadow rays can start up to the render distance away, so keep half that again loaded.
+        // Anything not generated yet is still air on the GPU and just shows up as sky
+        const float loadRadius = renderMode.renderDistance * 1.5f;
+        reportWorldReady(World::requestNearby(playerPos, loadRadius));
+        const bool terrainPending = useGpuTerrain && streamGpuTerrain(playerPos, loadRadius);
+        const bool chunksPending = uploadGeneratedChunks();
+        const bool bricksPending = Brickmap::update(playerPos);
+        updateLayoutTuning(terrainPending || chunksPending || bricksPending);
+
         //raycast(SCR_RES / 2.0f, hoveredBlockPos, placeBlockPos);
 
         //std::cout << hoveredBlockPos << "\n";
@@ -309,62 +761,120 @@ void run(GLFWwindow* window) {
 
         frustumDiv = (SCR_RES * FOV) / defaultRes;
 
-        computeShader.use();
+        raytraceShader->use();
 
-        glBindImageTexture(1, worldTexture, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R8UI);
-        computeShader.setVec2("screenSize", SCR_RES.x, SCR_RES.y);
+        Brickmap::bind(renderMode.worldSampler);
 
-        glBindTexture(GL_TEXTURE_2D, textureAtlasTex);
-        computeShader.setInt("textureAtlas", 0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, blockTextures);
+        raytraceUniforms.blockTextures.set(0);
 
-        computeShader.setFloat("camera.cosYaw", cos(cameraYaw));
-        computeShader.setFloat("camera.cosPitch", cos(cameraPitch));
-        computeShader.setFloat("camera.sinYaw", sin(cameraYaw));
-        computeShader.setFloat("camera.sinPitch", sin(cameraPitch));
-        computeShader.setVec2("camera.frustumDiv", frustumDiv);
-        computeShader.setVec3("camera.pos", playerPos);
+        FrameUniforms::Frame frame = {};
+        frame.camera.pos = playerPos;
+        frame.camera.cosYaw = cos(cameraYaw);
+        frame.camera.cosPitch = cos(cameraPitch);
+        frame.camera.sinYaw = sin(cameraYaw);
+        frame.camera.sinPitch = sin(cameraPitch);
+        frame.camera.frustumDiv = frustumDiv;
+        frame.screenSize = SCR_RES;
+        frame.lightDirection = lightDirection;
+        frame.skyColor = skyColor;
+        frame.ambColor = ambColor;
+        frame.sunColor = sunColor;
+        frame.brickWindow = Brickmap::window();
 
-#ifdef CLASSIC
-
-#else
-        computeShader.setVec3("lightDirection", lightDirection);
-        computeShader.setVec3("skyColor", skyColor);
-        computeShader.setVec3("ambColor", ambColor);
-        computeShader.setVec3("sunColor", sunColor);
-#endif
+        FrameUniforms::update(frame);
 
         //computeShader.setVec3("fogColor", skyColor);
 
 
         glInvalidateTexImage(screenTexture, 0);
 
+        // the previous frame's time, if the GPU is done with it
+        if (frameTimeQueryPending) {
+            GLint available = 0;
+            glGetQueryObjectiv(frameTimeQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+
+            if (available) {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(frameTimeQuery, GL_QUERY_RESULT, &nanoseconds);
+
+                if (!frameTimeQueryStale) {
+                    frameTimeTotal += nanoseconds / 1e6;
+                    frameTimeCount++;
+                }
+
+                frameTimeQueryPending = false;
+                frameTimeQueryStale = false;
+
+                updateSweep();
+            }
+        }
+
+        const bool timingFrame = !frameTimeQueryPending;
+        if (timingFrame)
+            glBeginQuery(GL_TIME_ELAPSED, frameTimeQuery);
+
         glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-        glDispatchCompute((SCR_RES.x + 15) / 16, (SCR_RES.y + 15) / 16, 1);
-        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        const RaytraceTuning::Layout& layout = renderMode.layout;
+        glDispatchCompute((int(SCR_RES.x) + layout.groupWidth - 1) / layout.groupWidth,
+                          (int(SCR_RES.y) + layout.groupHeight - 1) / layout.groupHeight, 1);
+        FrameUniforms::endFrame();
         glUseProgram(0);
 
-        // render the screen texture
-        screenShader.use();
-        glEnableVertexAttribArray(0);
-        glEnableVertexAttribArray(2);
+        if (blitToScreen) {
+            // the raytracer's rows run top to bottom, so the blit flips y like the quad's texture coordinates do
+            glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
 
-        glBindTexture(GL_TEXTURE_2D, screenTexture);
-        glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), reinterpret_cast<void*>(2 * sizeof(float)));
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, screenFramebuffer);
+            glBlitFramebuffer(0, 0, int(SCR_RES.x), int(SCR_RES.y),
+                              0, windowSize.y, windowSize.x, 0,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        }
+        else {
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
 
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+            // render the screen texture
+            screenShader.use();
+            glEnableVertexAttribArray(0);
+            glEnableVertexAttribArray(2);
 
-        glDisableVertexAttribArray(2);
-        glDisableVertexAttribArray(0);
+            glBindTexture(GL_TEXTURE_2D, screenTexture);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), reinterpret_cast<void*>(2 * sizeof(float)));
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        glUseProgram(0);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+
+            glDisableVertexAttribArray(2);
+            glDisableVertexAttribArray(0);
+
+            glUseProgram(0);
+        }
+
+        if (timingFrame) {
+            glEndQuery(GL_TIME_ELAPSED);
+            frameTimeQueryPending = true;
+        }
+
+        if (sweepStep < 0 && frameTimeCount > 0 && currentTime() - lastFrameTimeReport > 2000) {
+            lastFrameTimeReport = currentTime();
+
+            std::cout << SCREEN_FORMATS[renderMode.screenFormat].name << ", " << (blitToScreen ? "blit" : "quad") << ", "
+                      << int(SCR_RES.x) << "x" << int(SCR_RES.y) << ": "
+                      << frameTimeTotal / frameTimeCount << " ms GPU per frame, "
+                      << Brickmap::residentBricks() << " / " << Brickmap::capacity() << " bricks resident\n";
+
+            frameTimeTotal = 0;
+            frameTimeCount = 0;
+        }
 
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    World::stopGenerationThreads();
 
     glfwTerminate();
 }
@@ -429,6 +939,44 @@ void key_callback(GLFWwindow*, const int key, const int scancode, const int acti
             SCR_DETAIL++;
             needsResUpdate = true;
             break;
+        case GLFW_KEY_F1:
+            renderMode.shadows = !renderMode.shadows;
+            updateRenderMode();
+            break;
+        case GLFW_KEY_F2:
+            renderMode.mirrors = !renderMode.mirrors;
+            updateRenderMode();
+            break;
+        case GLFW_KEY_F3:
+            renderMode.classicFog = !renderMode.classicFog;
+            updateRenderMode();
+            break;
+        case GLFW_KEY_MINUS:
+            renderMode.renderDistance = std::max(renderMode.renderDistance - 16, MIN_RENDER_DIST);
+            updateRenderMode();
+            break;
+        case GLFW_KEY_EQUAL:
+            renderMode.renderDistance = std::min(renderMode.renderDistance + 16, MAX_RENDER_DIST);
+            updateRenderMode();
+            break;
+        case GLFW_KEY_F4:
+            renderMode.screenFormat = (renderMode.screenFormat + 1) % SCREEN_FORMAT_COUNT;
+            updateRenderMode();
+            break;
+        case GLFW_KEY_F5:
+            blitToScreen = !blitToScreen;
+            updateRenderMode();
+            break;
+        case GLFW_KEY_F6:
+            renderMode.worldSampler = !renderMode.worldSampler;
+            updateRenderMode();
+            break;
+        case GLFW_KEY_F7:
+            startWorldFetchBenchmark();
+            break;
+        case GLFW_KEY_F8:
+            startLayoutTuning();
+            break;
         }
     } else // action == GLFW_RELEASE
     {
@@ -474,23 +1022,87 @@ void initBuffers(GLuint* vao, GLuint* buffer) {
 }
 
 void initTexture(GLuint* texture, const int width, const int height) {
+    screenTextureFormat = renderMode.screenFormat;
+    const GLenum format = SCREEN_FORMATS[screenTextureFormat].internalFormat;
+
     glGenTextures(1, texture);
     glBindTexture(GL_TEXTURE_2D, *texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
-    glBindImageTexture(0, *texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    glBindImageTexture(0, *texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, format);
+
+    if (!screenFramebuffer)
+        glGenFramebuffers(1, &screenFramebuffer);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, screenFramebuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
     glViewport(0, 0, width, height);
+    windowSize = glm::ivec2(width, height);
+}
+
+// all digits and in range for World::generateWorld
+static bool isSeed(const char* arg)
+{
+    char* end;
+    errno = 0;
+    std::strtoull(arg, &end, 10);
+
+    return end != arg && *end == '\0' && errno != ERANGE;
 }
 
 int main(const int argc, const char** argv)
 {
+    const auto startTime = std::chrono::steady_clock::now();
+
+    // optional world seed, otherwise the last one. -newworld picks a new random seed instead,
+    // -gputerrain runs the terrain pass on the GPU ahead of the CPU chunks, -verifyterrain does too and compares the two,
+    // -autotune times the raytracer layouts again even if this driver has a cached pick,
+    // -brickbudget sets the megabytes of VRAM the brick atlas may take
+    const char* seedArg = nullptr;
+    bool newWorld = false;
+    bool gpuTerrain = false;
+    bool autotune = false;
+    int brickBudget = Brickmap::DEFAULT_BUDGET_MB;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-newworld") == 0)
+            newWorld = true;
+        else if (strcmp(argv[i], "-gputerrain") == 0)
+            gpuTerrain = true;
+        else if (strcmp(argv[i], "-verifyterrain") == 0)
+            gpuTerrain = verifyGpuTerrain = true;
+        else if (strcmp(argv[i], "-autotune") == 0)
+            autotune = true;
+        else if (strcmp(argv[i], "-textureres") == 0 && i + 1 < argc)
+            textureRes = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-brickbudget") == 0 && i + 1 < argc)
+            brickBudget = std::max(1, atoi(argv[++i]));
+        else if (argv[i][0] != '-' && !seedArg && isSeed(argv[i]))
+            seedArg = argv[i];
+        else
+        {
+            // a typo would otherwise become seed 0 and fill the disk cache
+            std::cout << "Unknown argument " << argv[i] << "\n"
+                      << "Usage: Minecraft4k [seed] [-newworld] [-gputerrain] [-verifyterrain] [-autotune] [-textureres n] [-brickbudget MB]\n";
+            return -1;
+        }
+    }
+
+    if (textureRes < TEXTURE_RES || textureRes > MAX_TEXTURE_RES || textureRes % TEXTURE_RES != 0)
+    {
+        std::cout << "Texture resolution must be a multiple of " << TEXTURE_RES << " up to " << MAX_TEXTURE_RES << "\n";
+        return -1;
+    }
+
     std::cout << "Initializing GLFW... ";
 
     if (!glfwInit())
@@ -561,27 +1173,46 @@ int main(const int argc, const char** argv)
 
     std::cout << "Done!\n";
 
+    // compiled shaders and generated textures from earlier runs
+    AssetCache::setDirectory("cache/assets");
+
+    // the shaders need the atlas layout
+    std::cout << "Allocating world on GPU... ";
+    Brickmap::init(size_t(brickBudget) * 1024 * 1024);
+    std::cout << "Done!\n";
+
     std::cout << "Building shaders... ";
+    const auto shaderStartTime = std::chrono::steady_clock::now();
+
     std::stringstream defines;
     defines << "#define WORLD_SIZE " << WORLD_SIZE << "\n"
             << "#define WORLD_HEIGHT " << WORLD_HEIGHT << "\n"
-            << "#define TEXTURE_RES " << TEXTURE_RES << "\n"
-            << "#define RENDER_DIST " << RENDER_DIST << "\n";
-#ifdef CLASSIC
-    defines << "#define CLASSIC\n";
-#endif
-
-    const std::string definesStr = defines.str();
+            << "#define TEXTURE_RES " << textureRes << "\n"
+            << Brickmap::defines();
 
     screenShader = Shader("screen", "screen");
-    computeShader = Shader("raytrace", HasExtra::Yes, definesStr.c_str());
+    raytraceShaders = ShaderPermutations("raytrace", defines.str());
 
-    std::cout << "Done!\n";
+    // the layout tuned on an earlier run, otherwise it gets tuned once the world is in
+    tuningPending = autotune || !RaytraceTuning::loadCached(renderMode.layout);
+
+    // build the starting variant now rather than on the first frame
+    updateRenderMode();
+
+#ifndef CLASSIC // the classic generator draws every block from one random stream, that stays on the CPU
+    useGpuTerrain = gpuTerrain && GpuTerrain::init();
+#else
+    (void)gpuTerrain;
+#endif
+
+    std::cout << "Done in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shaderStartTime).count() << " ms!\n";
     
     glActiveTexture(GL_TEXTURE0);
 
     std::cout << "Building buffers... ";
     initBuffers(&vao, &buffer);
+    FrameUniforms::init(reinterpret_cast<GLADloadproc>(glfwGetProcAddress));
+    glGenQueries(1, &frameTimeQuery);
     std::cout << "Done!\n";
 
     std::cout << "Building render texture... ";
@@ -589,8 +1220,9 @@ int main(const int argc, const char** argv)
     std::cout << "Done!\n";
 
     std::cout << "Initializing engine...\n";
-    init();
-    std::cout << "Finished initializing engine! Running the game...\n";
+    init(seedArg, newWorld);
+    std::cout << "Finished initializing engine in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count()
+              << " ms! Running the game...\n";
 
     run(window);
 }
\ No newline at end of file
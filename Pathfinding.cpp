@@ -0,0 +1,1283 @@
+#include "Pathfinding.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+#include "Constants.h"
+#include "World.h"
+
+constexpr int MAX_PORTALS = 128; // per chunk
+
+constexpr int16_t SOURCE = -1;      // BFS tree root
+constexpr int16_t UNREACHED = -2;
+constexpr uint16_t NO_PATH = 0xFFFF;
+
+constexpr glm::ivec2 directions[4] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+
+// relative to the chunk
+struct LocalCell
+{
+    uint8_t x, y, z;
+};
+
+struct Portal
+{
+    int16_t cell;
+    glm::ivec3 pos;
+
+    // cells across the border this portal steps to, a corner portal can lead into two chunks
+    int crossingCount = 0;
+    glm::ivec3 crossings[2];
+    int16_t crossingPortals[2]; // the neighbour's portal at each of them, -1 if it has none there
+};
+
+// a walk from one portal to another within the chunk
+struct Link
+{
+    int16_t to;
+    uint16_t distance;
+};
+
+struct ChunkGraph
+{
+    bool built = false;
+    uint32_t revisions[5]; // of this chunk and the borders of its 4 neighbours when it was built
+
+    std::vector<LocalCell> cells;                       // standing cells, by column and then y
+    uint16_t columnStart[CHUNK_SIZE * CHUNK_SIZE + 1];
+    std::vector<int16_t> moves;                         // per cell, where each of the 4 directions leads within the chunk, or -1
+    std::vector<uint16_t> incomingStart;                // cells moving into each cell, for searching backwards from the goal
+    std::vector<int16_t> incoming;
+
+    std::vector<Portal> portals;
+    std::vector<uint16_t> distances;    // portals x portals
+    std::vector<uint16_t> linkStart;    // per portal, into links
+    std::vector<Link> links;            // the distances that aren't just a walk through another portal
+    std::vector<int16_t> parents;       // portals x cells, the BFS tree of every portal
+};
+
+static ChunkGraph graphs[CHUNK_COUNT * CHUNK_COUNT];
+
+// tags the search state that belongs to the current query
+static uint32_t queryId = 1;
+
+// the chunk being built plus one column of every neighbour
+constexpr int CACHE_SIZE = CHUNK_SIZE + 2;
+static uint8_t blockCache[CACHE_SIZE][WORLD_HEIGHT][CACHE_SIZE];
+static glm::ivec2 cacheOrigin;
+
+// above the world is open air like in collidePlayer, below it is solid
+static bool isAirCached(const int x, const int y, const int z)
+{
+    if (y < 0)
+        return true;
+    if (y >= WORLD_HEIGHT)
+        return false;
+
+    return blockCache[x - cacheOrigin.x][y][z - cacheOrigin.y] == BLOCK_AIR;
+}
+
+static bool isWalkableCached(const int x, const int y, const int z)
+{
+    return y >= 0 && y + 1 < WORLD_HEIGHT
+        && isAirCached(x, y, z) && isAirCached(x, y - 1, z) && !isAirCached(x, y + 1, z);
+}
+
+// where a walker standing at x, y, z ends up after a step in direction, -1 if it can't go there
+static int moveCached(const int x, const int y, const int z, const glm::ivec2& direction)
+{
+    const int nx = x + direction.x;
+    const int nz = z + direction.y;
+
+    // step up, which needs room to jump
+    if (!isAirCached(nx, y, nz))
+        return isWalkableCached(nx, y - 1, nz) && isAirCached(x, y - 2, z) ? y - 1 : -1;
+
+    if (!isAirCached(nx, y - 1, nz))
+        return -1;
+
+    // walk on or fall to the first ground below
+    for (int ny = y; ny <= y + Pathfinding::MAX_DROP && ny + 1 < WORLD_HEIGHT; ny++)
+        if (!isAirCached(nx, ny + 1, nz))
+            return ny;
+
+    return -1;
+}
+
+static void fillBlockCache(const int chunkX, const int chunkZ)
+{
+    cacheOrigin = glm::ivec2(chunkX, chunkZ) * CHUNK_SIZE - 1;
+
+    for (int x = 0; x < CACHE_SIZE; x++) {
+        for (int z = 0; z < CACHE_SIZE; z++) {
+            const int worldX = cacheOrigin.x + x;
+            const int worldZ = cacheOrigin.y + z;
+
+            // the world edge is a wall
+            const bool inside = worldX >= 0 && worldZ >= 0 && worldX < WORLD_SIZE && worldZ < WORLD_SIZE;
+
+            for (int y = 0; y < WORLD_HEIGHT; y++)
+                blockCache[x][y][z] = inside ? World::getBlock(worldX, y, worldZ) : BLOCK_STONE;
+        }
+    }
+}
+
+static int findCell(const ChunkGraph& graph, const int localX, const int y, const int localZ)
+{
+    const int column = localX + localZ * CHUNK_SIZE;
+
+    for (int i = graph.columnStart[column]; i < graph.columnStart[column + 1]; i++)
+        if (graph.cells[i].y == y)
+            return i;
+
+    return -1;
+}
+
+// Breadth first, every move costs the same. Backwards follows moves in reverse,
+// which leaves every cell pointing at the next one on its way to the source
+static void searchChunk(const ChunkGraph& graph, const int source, int16_t* parents, const bool backwards)
+{
+    static std::vector<int16_t> queue;
+
+    std::fill(parents, parents + graph.cells.size(), UNREACHED);
+    parents[source] = SOURCE;
+
+    queue.clear();
+    queue.push_back(int16_t(source));
+
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        const int cell = queue[head];
+
+        const auto visit = [&](const int next)
+        {
+            if (next >= 0 && parents[next] == UNREACHED) {
+                parents[next] = int16_t(cell);
+                queue.push_back(int16_t(next));
+            }
+        };
+
+        if (backwards) {
+            for (int i = graph.incomingStart[cell]; i < graph.incomingStart[cell + 1]; i++)
+                visit(graph.incoming[i]);
+        }
+        else {
+            for (int direction = 0; direction < 4; direction++)
+                visit(graph.moves[cell * 4 + direction]);
+        }
+    }
+}
+
+static int treeDistance(const int16_t* parents, int cell)
+{
+    if (parents[cell] == UNREACHED)
+        return -1;
+
+    int distance = 0;
+    for (; parents[cell] != SOURCE; cell = parents[cell])
+        distance++;
+
+    return distance;
+}
+
+struct Entrance
+{
+    glm::ivec3 lower, upper; // lower is the cell on the side with the smaller x or z
+    bool lowerToUpper, upperToLower;
+};
+
+// Every walkable crossing of the border between two chunks, grouped into stretches along the border,
+// keeping the middle crossing of each. Both chunks run this over the same two columns of blocks,
+// in the same order, so they agree on every entrance
+static void collectEntrances(const glm::ivec2& lowerStart, const glm::ivec2& across, const glm::ivec2& along, std::vector<Entrance>& entrances)
+{
+    struct Group
+    {
+        std::vector<Entrance> members;
+        int lastY;
+        bool extended;
+    };
+
+    std::vector<Group> open;
+    std::vector<Entrance> crossings;
+
+    const auto closeGroup = [&](const Group& group)
+    {
+        entrances.push_back(group.members[group.members.size() / 2]);
+    };
+
+    for (int i = 0; i <= CHUNK_SIZE; i++)
+    {
+        crossings.clear();
+
+        if (i < CHUNK_SIZE)
+        {
+            const glm::ivec2 lower = lowerStart + along * i;
+            const glm::ivec2 upper = lower + across;
+
+            for (int y = 0; y < WORLD_HEIGHT; y++)
+            {
+                if (isWalkableCached(lower.x, y, lower.y)) {
+                    const int upperY = moveCached(lower.x, y, lower.y, across);
+                    if (upperY >= 0)
+                        crossings.push_back({ glm::ivec3(lower.x, y, lower.y), glm::ivec3(upper.x, upperY, upper.y), true, false });
+                }
+            }
+
+            for (int y = 0; y < WORLD_HEIGHT; y++)
+            {
+                if (!isWalkableCached(upper.x, y, upper.y))
+                    continue;
+
+                const int lowerY = moveCached(upper.x, y, upper.y, -across);
+                if (lowerY < 0)
+                    continue;
+
+                const glm::ivec3 lowerCell = glm::ivec3(lower.x, lowerY, lower.y);
+                const glm::ivec3 upperCell = glm::ivec3(upper.x, y, upper.y);
+
+                bool merged = false;
+                for (Entrance& crossing : crossings)
+                {
+                    if (crossing.lower == lowerCell && crossing.upper == upperCell) {
+                        crossing.upperToLower = true;
+                        merged = true;
+                    }
+                }
+
+                if (!merged)
+                    crossings.push_back({ lowerCell, upperCell, false, true });
+            }
+
+            std::sort(crossings.begin(), crossings.end(), [](const Entrance& a, const Entrance& b)
+            {
+                return a.lower.y != b.lower.y ? a.lower.y < b.lower.y : a.upper.y < b.upper.y;
+            });
+        }
+
+        for (Group& group : open)
+            group.extended = false;
+
+        // a crossing continues a group from the previous position if it's at most a block higher or lower
+        std::vector<Group> next;
+        for (const Entrance& crossing : crossings)
+        {
+            Group* continued = nullptr;
+            for (Group& group : open)
+            {
+                if (!group.extended && std::abs(group.lastY - crossing.lower.y) <= 1) {
+                    continued = &group;
+                    break;
+                }
+            }
+
+            if (continued) {
+                continued->members.push_back(crossing);
+                continued->lastY = crossing.lower.y;
+                continued->extended = true;
+            }
+            else {
+                next.push_back({ { crossing }, crossing.lower.y, true });
+            }
+        }
+
+        for (Group& group : open)
+        {
+            if (group.extended)
+                next.push_back(std::move(group));
+            else
+                closeGroup(group);
+        }
+
+        open = std::move(next);
+    }
+}
+
+static void addPortal(ChunkGraph& graph, const glm::ivec3& pos, const bool canCross, const glm::ivec3& across)
+{
+    static bool warned = false;
+
+    Portal* portal = nullptr;
+    for (Portal& existing : graph.portals)
+        if (existing.pos == pos)
+            portal = &existing;
+
+    if (!portal)
+    {
+        if (graph.portals.size() == MAX_PORTALS) {
+            if (!warned)
+                std::cout << "Too many portals in chunk " << pos.x / CHUNK_SIZE << ", " << pos.z / CHUNK_SIZE << ", some paths will be missed\n";
+            warned = true;
+            return;
+        }
+
+        const glm::ivec2 base = cacheOrigin + 1;
+
+        Portal added;
+        added.cell = int16_t(findCell(graph, pos.x - base.x, pos.y, pos.z - base.y));
+        added.pos = pos;
+
+        graph.portals.push_back(added);
+        portal = &graph.portals.back();
+    }
+
+    if (canCross && portal->crossingCount < 2)
+        portal->crossings[portal->crossingCount++] = across;
+}
+
+static bool isWithinChunks(const int chunkX, const int chunkZ)
+{
+    return chunkX >= 0 && chunkZ >= 0 && chunkX < CHUNK_COUNT && chunkZ < CHUNK_COUNT;
+}
+
+static void currentRevisions(const int chunkX, const int chunkZ, uint32_t (&revisions)[5])
+{
+    revisions[0] = World::getChunkRevision(chunkX, chunkZ);
+
+    for (int i = 0; i < 4; i++)
+    {
+        const int neighbourX = chunkX + directions[i].x;
+        const int neighbourZ = chunkZ + directions[i].y;
+
+        revisions[i + 1] = isWithinChunks(neighbourX, neighbourZ) ? World::getChunkBorderRevision(neighbourX, neighbourZ) : 0;
+    }
+}
+
+static void buildGraph(const int chunkX, const int chunkZ, ChunkGraph& graph)
+{
+    fillBlockCache(chunkX, chunkZ);
+
+    const glm::ivec2 base = glm::ivec2(chunkX, chunkZ) * CHUNK_SIZE;
+
+    // standing cells
+    graph.cells.clear();
+    for (int z = 0; z < CHUNK_SIZE; z++) {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            graph.columnStart[x + z * CHUNK_SIZE] = uint16_t(graph.cells.size());
+
+            for (int y = 0; y < WORLD_HEIGHT; y++)
+                if (isWalkableCached(base.x + x, y, base.y + z))
+                    graph.cells.push_back({ uint8_t(x), uint8_t(y), uint8_t(z) });
+        }
+    }
+    graph.columnStart[CHUNK_SIZE * CHUNK_SIZE] = uint16_t(graph.cells.size());
+
+    const int cellCount = int(graph.cells.size());
+
+    // moves within the chunk, the border is crossed through portals
+    graph.moves.assign(cellCount * 4, -1);
+    graph.incomingStart.assign(cellCount + 1, 0);
+
+    for (int i = 0; i < cellCount; i++) {
+        const LocalCell& cell = graph.cells[i];
+
+        for (int direction = 0; direction < 4; direction++) {
+            const int x = cell.x + directions[direction].x;
+            const int z = cell.z + directions[direction].y;
+
+            if (x < 0 || z < 0 || x >= CHUNK_SIZE || z >= CHUNK_SIZE)
+                continue;
+
+            const int y = moveCached(base.x + cell.x, cell.y, base.y + cell.z, directions[direction]);
+            if (y < 0)
+                continue;
+
+            const int target = findCell(graph, x, y, z);
+            graph.moves[i * 4 + direction] = int16_t(target);
+            graph.incomingStart[target + 1]++;
+        }
+    }
+
+    for (int i = 0; i < cellCount; i++)
+        graph.incomingStart[i + 1] += graph.incomingStart[i];
+
+    graph.incoming.resize(graph.incomingStart[cellCount]);
+    std::vector<uint16_t> filled(graph.incomingStart.begin(), graph.incomingStart.end() - 1);
+
+    for (int i = 0; i < cellCount; i++)
+        for (int direction = 0; direction < 4; direction++)
+            if (graph.moves[i * 4 + direction] >= 0)
+                graph.incoming[filled[graph.moves[i * 4 + direction]]++] = int16_t(i);
+
+    // portals on all 4 borders, this chunk is the lower side of the +x and +z ones
+    graph.portals.clear();
+    std::vector<Entrance> entrances;
+
+    for (int direction = 0; direction < 4; direction++)
+    {
+        const glm::ivec2 neighbour = glm::ivec2(chunkX, chunkZ) + directions[direction];
+        if (!isWithinChunks(neighbour.x, neighbour.y))
+            continue;
+
+        const glm::ivec2 across = glm::ivec2(std::abs(directions[direction].x), std::abs(directions[direction].y));
+        const glm::ivec2 along = glm::ivec2(across.y, across.x);
+        const bool isLower = directions[direction].x + directions[direction].y > 0;
+
+        const glm::ivec2 lowerStart = isLower ? base + across * (CHUNK_SIZE - 1) : base - across;
+
+        entrances.clear();
+        collectEntrances(lowerStart, across, along, entrances);
+
+        for (const Entrance& entrance : entrances)
+        {
+            if (isLower)
+                addPortal(graph, entrance.lower, entrance.lowerToUpper, entrance.upper);
+            else
+                addPortal(graph, entrance.upper, entrance.upperToLower, entrance.lower);
+        }
+    }
+
+    // walking distances between portals, along with the way back from each one
+    const int portalCount = int(graph.portals.size());
+
+    graph.parents.resize(size_t(portalCount) * cellCount);
+    graph.distances.resize(size_t(portalCount) * portalCount);
+
+    for (int from = 0; from < portalCount; from++)
+    {
+        int16_t* parents = graph.parents.data() + size_t(from) * cellCount;
+        searchChunk(graph, graph.portals[from].cell, parents, false);
+
+        for (int to = 0; to < portalCount; to++)
+        {
+            const int distance = treeDistance(parents, graph.portals[to].cell);
+            graph.distances[from * portalCount + to] = distance < 0 ? NO_PATH : uint16_t(distance);
+        }
+    }
+
+    // A walk that passes another portal on a shortest way is already covered by the two walks either side
+    // of it. Leaving those out keeps every distance across the world the same with about half the links
+    graph.linkStart.resize(portalCount + 1);
+    graph.links.clear();
+
+    for (int from = 0; from < portalCount; from++)
+    {
+        graph.linkStart[from] = uint16_t(graph.links.size());
+
+        for (int to = 0; to < portalCount; to++)
+        {
+            const uint16_t distance = graph.distances[from * portalCount + to];
+            if (to == from || distance == NO_PATH)
+                continue;
+
+            bool covered = false;
+            for (int via = 0; via < portalCount && !covered; via++)
+            {
+                const uint16_t first = graph.distances[from * portalCount + via];
+                const uint16_t second = graph.distances[via * portalCount + to];
+
+                covered = via != from && via != to && first != NO_PATH && second != NO_PATH && first + second == distance;
+            }
+
+            if (!covered)
+                graph.links.push_back({ int16_t(to), distance });
+        }
+    }
+    graph.linkStart[portalCount] = uint16_t(graph.links.size());
+
+    graph.built = true;
+}
+
+enum class GraphUpdate
+{
+    Unchanged,
+    Rebuilt,        // same portals and links as before, only the cells changed
+    PortalsChanged, // the portal graph has to be rebuilt too
+};
+
+static bool samePortals(const std::vector<Portal>& a, const std::vector<Portal>& b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].pos != b[i].pos || a[i].crossingCount != b[i].crossingCount)
+            return false;
+
+        for (int crossing = 0; crossing < a[i].crossingCount; crossing++)
+            if (a[i].crossings[crossing] != b[i].crossings[crossing])
+                return false;
+    }
+
+    return true;
+}
+
+static bool sameLinks(const std::vector<Link>& a, const std::vector<Link>& b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].to != b[i].to || a[i].distance != b[i].distance)
+            return false;
+
+    return true;
+}
+
+static GraphUpdate updateGraph(const int chunkX, const int chunkZ)
+{
+    ChunkGraph& graph = graphs[chunkX + chunkZ * CHUNK_COUNT];
+
+    uint32_t revisions[5];
+    currentRevisions(chunkX, chunkZ, revisions);
+
+    if (graph.built && memcmp(revisions, graph.revisions, sizeof(revisions)) == 0)
+        return GraphUpdate::Unchanged;
+
+    // most edits don't move a portal or change a distance between two of them
+    static std::vector<Portal> oldPortals;
+    static std::vector<uint16_t> oldLinkStart;
+    static std::vector<Link> oldLinks;
+
+    const bool wasBuilt = graph.built;
+    oldPortals.swap(graph.portals);
+    oldLinkStart.swap(graph.linkStart);
+    oldLinks.swap(graph.links);
+
+    buildGraph(chunkX, chunkZ, graph);
+    memcpy(graph.revisions, revisions, sizeof(revisions));
+
+    const bool same = wasBuilt && samePortals(oldPortals, graph.portals) && oldLinkStart == graph.linkStart && sameLinks(oldLinks, graph.links);
+    return same ? GraphUpdate::Rebuilt : GraphUpdate::PortalsChanged;
+}
+
+// The portals of every chunk as one graph, numbered chunk by chunk. An edge is either a walk between two
+// portals of the same chunk or a step across a border, and the graph is stored both ways round
+struct PortalGraph
+{
+    bool built = false;
+    uint32_t epoch = 0; // bumped on every rebuild
+
+    int chunkFirstNode[CHUNK_COUNT * CHUNK_COUNT + 1];
+    std::vector<int> nodeChunk;
+    std::vector<glm::ivec3> nodePos;
+
+    std::vector<uint32_t> edgeStart;
+    std::vector<int> edgeTarget;
+    std::vector<uint32_t> edgeCost;
+
+    std::vector<uint32_t> reverseStart;
+    std::vector<int> reverseSource;
+    std::vector<uint32_t> reverseCost;
+
+    // Strongly connected components, numbered so every edge between two of them goes to a higher one.
+    // A portal can only reach the goal if its component reaches one of the goal's
+    std::vector<int> component;
+    int componentCount = 0;
+    int largestComponent = 0;
+    std::vector<uint32_t> componentPredecessorStart;
+    std::vector<int> componentPredecessors;
+
+    int nodeCount() const
+    {
+        return int(nodeChunk.size());
+    }
+};
+
+static PortalGraph portalGraph;
+
+// the three arrays of a graph in one direction
+struct Adjacency
+{
+    const std::vector<uint32_t>& start;
+    const std::vector<int>& target;
+    const std::vector<uint32_t>& cost;
+};
+
+// Flips the edges of a graph. Each node's edges are given by start, and group maps the nodes to the ones
+// of the flipped graph, which lets the components reuse this. Edges within one group are left out
+static void reverseEdges(const Adjacency& edges, const std::vector<int>& group, const int groupCount,
+                         std::vector<uint32_t>& start, std::vector<int>& source, std::vector<uint32_t>& cost)
+{
+    const int nodeCount = int(edges.start.size()) - 1;
+
+    start.assign(groupCount + 1, 0);
+    for (int node = 0; node < nodeCount; node++)
+        for (uint32_t e = edges.start[node]; e < edges.start[node + 1]; e++)
+            if (group[node] != group[edges.target[e]])
+                start[group[edges.target[e]] + 1]++;
+
+    for (int i = 0; i < groupCount; i++)
+        start[i + 1] += start[i];
+
+    source.resize(start[groupCount]);
+    cost.resize(start[groupCount]);
+
+    static std::vector<uint32_t> filled;
+    filled.assign(start.begin(), start.end() - 1);
+
+    for (int node = 0; node < nodeCount; node++)
+    {
+        for (uint32_t e = edges.start[node]; e < edges.start[node + 1]; e++)
+        {
+            const int to = group[edges.target[e]];
+            if (group[node] == to)
+                continue;
+
+            const uint32_t slot = filled[to]++;
+            source[slot] = group[node];
+            cost[slot] = edges.cost[e];
+        }
+    }
+}
+
+// Kosaraju, a depth first finishing order forwards, then components backwards in reverse finishing order
+static void findComponents(PortalGraph& graph)
+{
+    const int nodeCount = graph.nodeCount();
+
+    static std::vector<int> finished;
+    static std::vector<uint8_t> visited;
+    static std::vector<std::pair<int, uint32_t>> stack; // node and its next edge
+
+    finished.clear();
+    visited.assign(nodeCount, 0);
+
+    for (int root = 0; root < nodeCount; root++)
+    {
+        if (visited[root])
+            continue;
+
+        visited[root] = 1;
+        stack.emplace_back(root, graph.edgeStart[root]);
+
+        while (!stack.empty())
+        {
+            std::pair<int, uint32_t>& top = stack.back();
+
+            if (top.second == graph.edgeStart[top.first + 1]) {
+                finished.push_back(top.first);
+                stack.pop_back();
+                continue;
+            }
+
+            const int next = graph.edgeTarget[top.second++];
+            if (!visited[next]) {
+                visited[next] = 1;
+                stack.emplace_back(next, graph.edgeStart[next]);
+            }
+        }
+    }
+
+    graph.component.assign(nodeCount, -1);
+    graph.componentCount = 0;
+
+    static std::vector<int> sizes;
+    static std::vector<int> pending;
+
+    sizes.clear();
+
+    for (int i = nodeCount - 1; i >= 0; i--)
+    {
+        const int root = finished[i];
+        if (graph.component[root] >= 0)
+            continue;
+
+        const int component = graph.componentCount++;
+        int size = 0;
+
+        graph.component[root] = component;
+        pending.push_back(root);
+
+        while (!pending.empty())
+        {
+            const int node = pending.back();
+            pending.pop_back();
+            size++;
+
+            for (uint32_t e = graph.reverseStart[node]; e < graph.reverseStart[node + 1]; e++)
+            {
+                const int previous = graph.reverseSource[e];
+                if (graph.component[previous] < 0) {
+                    graph.component[previous] = component;
+                    pending.push_back(previous);
+                }
+            }
+        }
+
+        sizes.push_back(size);
+    }
+
+    graph.largestComponent = int(std::max_element(sizes.begin(), sizes.end()) - sizes.begin());
+
+    // the components leading into each one, duplicates included, they only cost a revisit
+    static std::vector<uint32_t> unused;
+    reverseEdges({ graph.edgeStart, graph.edgeTarget, graph.edgeCost }, graph.component, graph.componentCount,
+                 graph.componentPredecessorStart, graph.componentPredecessors, unused);
+}
+
+static void buildPortalGraph()
+{
+    PortalGraph& graph = portalGraph;
+
+    graph.nodeChunk.clear();
+    graph.nodePos.clear();
+
+    for (int chunk = 0; chunk < CHUNK_COUNT * CHUNK_COUNT; chunk++)
+    {
+        graph.chunkFirstNode[chunk] = graph.nodeCount();
+
+        for (const Portal& portal : graphs[chunk].portals) {
+            graph.nodeChunk.push_back(chunk);
+            graph.nodePos.push_back(portal.pos);
+        }
+    }
+    graph.chunkFirstNode[CHUNK_COUNT * CHUNK_COUNT] = graph.nodeCount();
+
+    // the edges come out in node order, so they go straight into place
+    graph.edgeStart.clear();
+    graph.edgeTarget.clear();
+    graph.edgeCost.clear();
+
+    for (int chunk = 0; chunk < CHUNK_COUNT * CHUNK_COUNT; chunk++)
+    {
+        const ChunkGraph& chunkGraph = graphs[chunk];
+        const int portalCount = int(chunkGraph.portals.size());
+        const int first = graph.chunkFirstNode[chunk];
+
+        for (int from = 0; from < portalCount; from++)
+        {
+            graph.edgeStart.push_back(uint32_t(graph.edgeTarget.size()));
+
+            for (int i = chunkGraph.linkStart[from]; i < chunkGraph.linkStart[from + 1]; i++) {
+                graph.edgeTarget.push_back(first + chunkGraph.links[i].to);
+                graph.edgeCost.push_back(chunkGraph.links[i].distance);
+            }
+
+            const Portal& portal = chunkGraph.portals[from];
+
+            for (int i = 0; i < portal.crossingCount; i++)
+            {
+                if (portal.crossingPortals[i] < 0)
+                    continue;
+
+                const glm::ivec3& target = portal.crossings[i];
+                graph.edgeTarget.push_back(graph.chunkFirstNode[target.x / CHUNK_SIZE + target.z / CHUNK_SIZE * CHUNK_COUNT] + portal.crossingPortals[i]);
+                graph.edgeCost.push_back(1);
+            }
+        }
+    }
+
+    graph.edgeStart.push_back(uint32_t(graph.edgeTarget.size()));
+
+    // every node is its own group, so nothing gets left out
+    static std::vector<int> identity;
+    for (int node = int(identity.size()); node < graph.nodeCount(); node++)
+        identity.push_back(node);
+
+    reverseEdges({ graph.edgeStart, graph.edgeTarget, graph.edgeCost }, identity, graph.nodeCount(),
+                 graph.reverseStart, graph.reverseSource, graph.reverseCost);
+
+    findComponents(graph);
+
+    graph.built = true;
+    graph.epoch++;
+}
+
+static void findCrossingPortals(ChunkGraph& graph)
+{
+    for (Portal& portal : graph.portals)
+    {
+        for (int i = 0; i < portal.crossingCount; i++)
+        {
+            const glm::ivec3& target = portal.crossings[i];
+            const std::vector<Portal>& targetPortals = graphs[target.x / CHUNK_SIZE + target.z / CHUNK_SIZE * CHUNK_COUNT].portals;
+
+            portal.crossingPortals[i] = -1;
+            for (int other = 0; other < int(targetPortals.size()); other++)
+                if (targetPortals[other].pos == target)
+                    portal.crossingPortals[i] = int16_t(other);
+        }
+    }
+}
+
+// Checks every chunk graph against the world, the portal graph is rebuilt if any of their portals or links changed.
+// True if it was.
+// This only happens at the start of a query, so chunks finishing on the generation threads can't rebuild
+// a graph while a search is still using it
+static bool updateGraphs()
+{
+    static bool rebuilt[CHUNK_COUNT * CHUNK_COUNT];
+    bool anyRebuilt = false;
+    bool changed = !portalGraph.built;
+
+    for (int chunkZ = 0; chunkZ < CHUNK_COUNT; chunkZ++)
+    {
+        for (int chunkX = 0; chunkX < CHUNK_COUNT; chunkX++) {
+            const GraphUpdate update = updateGraph(chunkX, chunkZ);
+
+            rebuilt[chunkX + chunkZ * CHUNK_COUNT] = update != GraphUpdate::Unchanged;
+            anyRebuilt |= update != GraphUpdate::Unchanged;
+            changed |= update == GraphUpdate::PortalsChanged;
+        }
+    }
+
+    if (!anyRebuilt && !changed)
+        return false;
+
+    // a rebuilt chunk can number its portals differently, so its neighbours look theirs up again too
+    for (int chunkZ = 0; chunkZ < CHUNK_COUNT; chunkZ++)
+    {
+        for (int chunkX = 0; chunkX < CHUNK_COUNT; chunkX++)
+        {
+            bool nearRebuilt = !portalGraph.built || rebuilt[chunkX + chunkZ * CHUNK_COUNT];
+            for (const glm::ivec2& direction : directions)
+                nearRebuilt |= isWithinChunks(chunkX + direction.x, chunkZ + direction.y)
+                            && rebuilt[chunkX + direction.x + (chunkZ + direction.y) * CHUNK_COUNT];
+
+            if (nearRebuilt)
+                findCrossingPortals(graphs[chunkX + chunkZ * CHUNK_COUNT]);
+        }
+    }
+
+    if (changed)
+        buildPortalGraph();
+
+    return changed;
+}
+
+// Landmarks on the edges of the world with their walking distance to and from every portal. By the
+// triangle inequality the rest of the way can't be shorter than the difference to any of them, which
+// is a much tighter estimate than the Manhattan distance once paths have to go around things
+constexpr int LANDMARK_COUNT = 8;
+constexpr uint32_t UNREACHABLE = 0xFFFFFFFF;
+
+struct Landmark
+{
+    int node = -1;
+    uint32_t nodeEpoch = 0;     // of the portal graph node was picked on
+    uint32_t fromEpoch = 0;     // and the ones each way was measured on, stale ones aren't used
+    uint32_t toEpoch = 0;
+    std::vector<uint32_t> from; // from the landmark to every portal
+    std::vector<uint32_t> to;   // from every portal to the landmark
+};
+
+static Landmark landmarks[LANDMARK_COUNT];
+
+// the world's corners and the middle of its sides
+static const glm::ivec2 landmarkSpots[LANDMARK_COUNT] = {
+    { 0, 0 }, { WORLD_SIZE, 0 }, { 0, WORLD_SIZE }, { WORLD_SIZE, WORLD_SIZE },
+    { WORLD_SIZE / 2, 0 }, { WORLD_SIZE / 2, WORLD_SIZE }, { 0, WORLD_SIZE / 2 }, { WORLD_SIZE, WORLD_SIZE / 2 },
+};
+
+// Dijkstra with a bucket per distance, the costs are small whole numbers and never 0 so this beats a heap
+static void measureDistances(const Adjacency& adjacency, const int source, std::vector<uint32_t>& distances)
+{
+    static std::vector<std::vector<int>> buckets;
+
+    distances.assign(adjacency.start.size() - 1, UNREACHABLE);
+    distances[source] = 0;
+
+    if (buckets.empty())
+        buckets.resize(1);
+    buckets[0].push_back(source);
+
+    for (uint32_t distance = 0; distance < buckets.size(); distance++)
+    {
+        for (size_t i = 0; i < buckets[distance].size(); i++)
+        {
+            const int node = buckets[distance][i];
+            if (distances[node] != distance)
+                continue;
+
+            for (uint32_t e = adjacency.start[node]; e < adjacency.start[node + 1]; e++)
+            {
+                const uint32_t next = distance + adjacency.cost[e];
+                const int target = adjacency.target[e];
+
+                if (next < distances[target]) {
+                    distances[target] = next;
+
+                    if (next >= buckets.size())
+                        buckets.resize(next + 1);
+                    buckets[next].push_back(target);
+                }
+            }
+        }
+
+        buckets[distance].clear();
+    }
+}
+
+static void measureLandmark(const int index, const bool forwards)
+{
+    const PortalGraph& graph = portalGraph;
+    Landmark& landmark = landmarks[index];
+
+    // the portal of the largest component closest to its spot, so it reaches and is reached by most of the world
+    if (landmark.nodeEpoch != graph.epoch)
+    {
+        landmark.node = -1;
+        landmark.nodeEpoch = graph.epoch;
+
+        int best = 0;
+        for (int i = 0; i < graph.nodeCount(); i++)
+        {
+            const int distance = std::abs(graph.nodePos[i].x - landmarkSpots[index].x) + std::abs(graph.nodePos[i].z - landmarkSpots[index].y);
+
+            if (graph.component[i] == graph.largestComponent && (landmark.node < 0 || distance < best)) {
+                landmark.node = i;
+                best = distance;
+            }
+        }
+    }
+
+    std::vector<uint32_t>& distances = forwards ? landmark.from : landmark.to;
+    (forwards ? landmark.fromEpoch : landmark.toEpoch) = graph.epoch;
+
+    if (landmark.node < 0)
+        distances.assign(graph.nodeCount(), UNREACHABLE);
+    else if (forwards)
+        measureDistances({ graph.edgeStart, graph.edgeTarget, graph.edgeCost }, landmark.node, distances);
+    else
+        measureDistances({ graph.reverseStart, graph.reverseSource, graph.reverseCost }, landmark.node, distances);
+}
+
+// A query only measures one stale landmark one way, and none if it just rebuilt the portal graph, so a changed
+// block spreads its cost over the next few searches. They make do with the distances that are left until then
+static void updateLandmarks(const bool all)
+{
+    for (int i = 0; i < LANDMARK_COUNT; i++)
+    {
+        for (const bool forwards : { true, false })
+        {
+            if ((forwards ? landmarks[i].fromEpoch : landmarks[i].toEpoch) == portalGraph.epoch)
+                continue;
+
+            measureLandmark(i, forwards);
+
+            if (!all)
+                return;
+        }
+    }
+}
+
+bool Pathfinding::isWalkable(const glm::ivec3& pos)
+{
+    if (pos.x < 0 || pos.z < 0 || pos.x >= WORLD_SIZE || pos.z >= WORLD_SIZE || pos.y < 0 || pos.y + 1 >= WORLD_HEIGHT)
+        return false;
+
+    return World::getBlock(pos.x, pos.y, pos.z) == BLOCK_AIR
+        && (pos.y == 0 || World::getBlock(pos.x, pos.y - 1, pos.z) == BLOCK_AIR)
+        && World::getBlock(pos.x, pos.y + 1, pos.z) != BLOCK_AIR;
+}
+
+bool Pathfinding::findSurface(const int x, const int z, glm::ivec3& pos)
+{
+    for (int y = 0; y + 1 < WORLD_HEIGHT; y++)
+    {
+        pos = glm::ivec3(x, y, z);
+        if (isWalkable(pos))
+            return true;
+    }
+
+    return false;
+}
+
+void Pathfinding::buildAllGraphs()
+{
+    updateGraphs();
+    updateLandmarks(true);
+}
+
+// only valid where query matches the current one, so nothing needs clearing between searches
+struct NodeState
+{
+    uint32_t query;
+    uint32_t cost;
+    int32_t parent;
+    bool closed;
+};
+
+static std::vector<NodeState> nodes;
+
+static glm::ivec3 toWorld(const glm::ivec2& chunk, const LocalCell& cell)
+{
+    return glm::ivec3(chunk.x * CHUNK_SIZE + cell.x, cell.y, chunk.y * CHUNK_SIZE + cell.z);
+}
+
+// appends the cells from the root of a forward tree to cell, leaving out the root itself
+static void appendFromRoot(const ChunkGraph& graph, const glm::ivec2& chunk, const int16_t* parents, int cell, std::vector<glm::ivec3>& path)
+{
+    const size_t first = path.size();
+
+    for (; parents[cell] != SOURCE; cell = parents[cell])
+        path.push_back(toWorld(chunk, graph.cells[cell]));
+
+    std::reverse(path.begin() + first, path.end());
+}
+
+// appends the cells after cell on its way to the root of a backwards tree
+static void appendToRoot(const ChunkGraph& graph, const glm::ivec2& chunk, const int16_t* next, int cell, std::vector<glm::ivec3>& path)
+{
+    for (; next[cell] != SOURCE; cell = next[cell])
+        path.push_back(toWorld(chunk, graph.cells[next[cell]]));
+}
+
+bool Pathfinding::findPath(const glm::ivec3& start, const glm::ivec3& goal, std::vector<glm::ivec3>& path)
+{
+    path.clear();
+
+    if (!isWalkable(start) || !isWalkable(goal))
+        return false;
+
+    queryId++;
+
+    if (!updateGraphs())
+        updateLandmarks(false);
+
+    const PortalGraph& graph = portalGraph;
+
+    // A* over the portals, plus a start and a goal node that connect to the portals of their own chunk
+    const int startNode = graph.nodeCount();
+    const int goalNode = graph.nodeCount() + 1;
+
+    if (nodes.size() < size_t(graph.nodeCount()) + 2)
+        nodes.resize(graph.nodeCount() + 2, NodeState{ 0, 0, -1, false });
+
+    const glm::ivec2 startChunk = glm::ivec2(start.x, start.z) / CHUNK_SIZE;
+    const glm::ivec2 goalChunk = glm::ivec2(goal.x, goal.z) / CHUNK_SIZE;
+    const int startChunkIndex = startChunk.x + startChunk.y * CHUNK_COUNT;
+    const int goalChunkIndex = goalChunk.x + goalChunk.y * CHUNK_COUNT;
+
+    const ChunkGraph& startGraph = graphs[startChunkIndex];
+    const ChunkGraph& goalGraph = graphs[goalChunkIndex];
+
+    const int startCell = findCell(startGraph, start.x % CHUNK_SIZE, start.y, start.z % CHUNK_SIZE);
+    const int goalCell = findCell(goalGraph, goal.x % CHUNK_SIZE, goal.y, goal.z % CHUNK_SIZE);
+
+    // the start and goal chunks get searched block by block, forwards from the start and backwards from the goal.
+    // Forwards from the goal too, that's the goal's way out to the landmarks
+    static std::vector<int16_t> startParents;
+    static std::vector<int16_t> goalNext;
+    static std::vector<int16_t> goalParents;
+
+    startParents.resize(startGraph.cells.size());
+    goalNext.resize(goalGraph.cells.size());
+    goalParents.resize(goalGraph.cells.size());
+
+    searchChunk(startGraph, startCell, startParents.data(), false);
+    searchChunk(goalGraph, goalCell, goalNext.data(), true);
+    searchChunk(goalGraph, goalCell, goalParents.data(), false);
+
+    // walking distances between the goal and each of its chunk's portals, -1 if there's no way
+    static std::vector<int> toGoal;
+    static std::vector<int> fromGoal;
+
+    toGoal.resize(goalGraph.portals.size());
+    fromGoal.resize(goalGraph.portals.size());
+
+    for (size_t portal = 0; portal < goalGraph.portals.size(); portal++) {
+        toGoal[portal] = treeDistance(goalNext.data(), goalGraph.portals[portal].cell);
+        fromGoal[portal] = treeDistance(goalParents.data(), goalGraph.portals[portal].cell);
+    }
+
+    // mark the components that lead to the goal, everything else is a dead end and never enters the open list
+    static std::vector<uint32_t> leadsToGoal;
+    static std::vector<int> pending;
+
+    leadsToGoal.resize(graph.componentCount, 0);
+    pending.clear();
+
+    for (size_t portal = 0; portal < goalGraph.portals.size(); portal++)
+    {
+        const int component = graph.component[graph.chunkFirstNode[goalChunkIndex] + int(portal)];
+
+        if (toGoal[portal] >= 0 && leadsToGoal[component] != queryId) {
+            leadsToGoal[component] = queryId;
+            pending.push_back(component);
+        }
+    }
+
+    while (!pending.empty())
+    {
+        const int component = pending.back();
+        pending.pop_back();
+
+        for (uint32_t i = graph.componentPredecessorStart[component]; i < graph.componentPredecessorStart[component + 1]; i++)
+        {
+            const int previous = graph.componentPredecessors[i];
+            if (leadsToGoal[previous] != queryId) {
+                leadsToGoal[previous] = queryId;
+                pending.push_back(previous);
+            }
+        }
+    }
+
+    // what the heuristic needs from every landmark: the distance from it to the goal, and an upper bound of
+    // the distance from the goal to it, walking out through one of the goal chunk's portals
+    struct LandmarkBounds
+    {
+        const Landmark* landmark;
+        uint32_t landmarkToGoal;
+        uint32_t goalToLandmark;
+    };
+
+    LandmarkBounds bounds[LANDMARK_COUNT];
+    int boundCount = 0;
+
+    for (const Landmark& landmark : landmarks)
+    {
+        const bool fromFresh = landmark.fromEpoch == graph.epoch;
+        const bool toFresh = landmark.toEpoch == graph.epoch;
+
+        if (!fromFresh && !toFresh)
+            continue;
+
+        LandmarkBounds& bound = bounds[boundCount++];
+        bound = { &landmark, UNREACHABLE, UNREACHABLE };
+
+        for (size_t portal = 0; portal < goalGraph.portals.size(); portal++)
+        {
+            const int node = graph.chunkFirstNode[goalChunkIndex] + int(portal);
+
+            if (fromFresh && toGoal[portal] >= 0 && landmark.from[node] != UNREACHABLE)
+                bound.landmarkToGoal = std::min(bound.landmarkToGoal, landmark.from[node] + toGoal[portal]);
+
+            if (toFresh && fromGoal[portal] >= 0 && landmark.to[node] != UNREACHABLE)
+                bound.goalToLandmark = std::min(bound.goalToLandmark, landmark.to[node] + fromGoal[portal]);
+        }
+    }
+
+    // every move changes x or z by one, and no way is shorter than the triangle inequality allows
+    const auto heuristic = [&](const int node)
+    {
+        const glm::ivec3& pos = graph.nodePos[node];
+        uint32_t estimate = uint32_t(std::abs(pos.x - goal.x) + std::abs(pos.z - goal.z));
+
+        for (int i = 0; i < boundCount; i++)
+        {
+            const LandmarkBounds& bound = bounds[i];
+
+            // the bounds stay unreachable for a way that's stale, its distances may not even cover this node
+            if (bound.landmarkToGoal != UNREACHABLE) {
+                const uint32_t fromLandmark = bound.landmark->from[node];
+                if (fromLandmark != UNREACHABLE && bound.landmarkToGoal > fromLandmark)
+                    estimate = std::max(estimate, bound.landmarkToGoal - fromLandmark);
+            }
+
+            if (bound.goalToLandmark != UNREACHABLE) {
+                const uint32_t toLandmark = bound.landmark->to[node];
+                if (toLandmark != UNREACHABLE && toLandmark > bound.goalToLandmark)
+                    estimate = std::max(estimate, toLandmark - bound.goalToLandmark);
+            }
+        }
+
+        return estimate;
+    };
+
+    // A min heap of (estimated total cost, node), kept between queries to save the allocations.
+    // The estimate is shifted up with the rest of the way in the low bits, so ties go to the node closest to the goal
+    using OpenNode = std::pair<uint64_t, int>;
+    static std::vector<OpenNode> open;
+    open.clear();
+
+    const auto relax = [&](const int node, const uint32_t cost, const int parent)
+    {
+        if (node < startNode && leadsToGoal[graph.component[node]] != queryId)
+            return;
+
+        NodeState& state = nodes[node];
+        if (state.query == queryId && (state.closed || state.cost <= cost))
+            return;
+
+        state = { queryId, cost, parent, false };
+
+        const uint32_t estimate = node < startNode ? heuristic(node) : 0;
+        open.emplace_back(uint64_t(cost + estimate) << 32 | estimate, node);
+        std::push_heap(open.begin(), open.end(), std::greater<OpenNode>());
+    };
+
+    relax(startNode, 0, -1);
+
+    bool found = false;
+
+    while (!open.empty())
+    {
+        std::pop_heap(open.begin(), open.end(), std::greater<OpenNode>());
+        const int node = open.back().second;
+        open.pop_back();
+
+        if (nodes[node].closed)
+            continue;
+        nodes[node].closed = true;
+
+        if (node == goalNode) {
+            found = true;
+            break;
+        }
+
+        const uint32_t cost = nodes[node].cost;
+
+        if (node == startNode)
+        {
+            for (int portal = 0; portal < int(startGraph.portals.size()); portal++)
+            {
+                const int distance = treeDistance(startParents.data(), startGraph.portals[portal].cell);
+                if (distance >= 0)
+                    relax(graph.chunkFirstNode[startChunkIndex] + portal, cost + distance, node);
+            }
+
+            if (startChunk == goalChunk && startParents[goalCell] != UNREACHED)
+                relax(goalNode, cost + treeDistance(startParents.data(), goalCell), node);
+
+            continue;
+        }
+
+        for (uint32_t e = graph.edgeStart[node]; e < graph.edgeStart[node + 1]; e++)
+            relax(graph.edgeTarget[e], cost + graph.edgeCost[e], node);
+
+        if (graph.nodeChunk[node] == goalChunkIndex) {
+            const int distance = toGoal[node - graph.chunkFirstNode[goalChunkIndex]];
+            if (distance >= 0)
+                relax(goalNode, cost + distance, node);
+        }
+    }
+
+    if (!found)
+        return false;
+
+    // back from the goal to the start, then walk every step of it
+    static std::vector<int> route;
+    route.clear();
+    for (int node = goalNode; node != -1; node = nodes[node].parent)
+        route.push_back(node);
+    std::reverse(route.begin(), route.end());
+
+    const auto portalCell = [&](const int node)
+    {
+        return graphs[graph.nodeChunk[node]].portals[node - graph.chunkFirstNode[graph.nodeChunk[node]]].cell;
+    };
+
+    path.push_back(start);
+
+    for (size_t i = 0; i + 1 < route.size(); i++)
+    {
+        const int from = route[i];
+        const int to = route[i + 1];
+
+        if (from == startNode) {
+            appendFromRoot(startGraph, startChunk, startParents.data(), to == goalNode ? goalCell : portalCell(to), path);
+        }
+        else if (to == goalNode) {
+            appendToRoot(goalGraph, goalChunk, goalNext.data(), portalCell(from), path);
+        }
+        else if (graph.nodeChunk[from] == graph.nodeChunk[to]) {
+            const int chunkIndex = graph.nodeChunk[from];
+            const ChunkGraph& chunkGraph = graphs[chunkIndex];
+            const glm::ivec2 chunk = glm::ivec2(chunkIndex % CHUNK_COUNT, chunkIndex / CHUNK_COUNT);
+
+            appendFromRoot(chunkGraph, chunk, chunkGraph.parents.data() + size_t(from - graph.chunkFirstNode[chunkIndex]) * chunkGraph.cells.size(),
+                           portalCell(to), path);
+        }
+        else {
+            path.push_back(graph.nodePos[to]);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include <glm/vec3.hpp>
+
+// A* for walkers the size of the player. A standing cell is an air block with air above it (y - 1)
+// and a solid block below it (y + 1), the same two blocks collidePlayer checks.
+// Moves go to one of the 4 neighbouring columns, climbing at most one block or dropping at most MAX_DROP.
+//
+// Searches are hierarchical. Every chunk caches a graph of its portals (one cell per stretch of
+// walkable border) along with the walking distance between them. A* runs over the portals of the whole
+// world, and only the chunks holding the start and the goal are searched block by block. Portals that
+// can't lead to the goal are skipped, and the distances to a few landmarks tighten the estimate.
+// A chunk's graph is rebuilt once World reports that it or one of its neighbours changed,
+// the world's portal graph whenever a chunk graph was. Not thread safe
+namespace Pathfinding
+{
+    constexpr int MAX_DROP = 3;
+
+    bool isWalkable(const glm::ivec3& pos);
+
+    // the topmost standing cell of a column, false if there is none
+    bool findSurface(int x, int z, glm::ivec3& pos);
+
+    // fills path with every cell from start to goal, both included. False if the goal can't be reached
+    bool findPath(const glm::ivec3& start, const glm::ivec3& goal, std::vector<glm::ivec3>& path);
+
+    // builds every chunk graph now instead of on first use
+    void buildAllGraphs();
+}
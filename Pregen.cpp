@@ -0,0 +1,466 @@
+// Headless world pregeneration into region files, no window or OpenGL context needed.
+// Usage: Pregen [-size blocks] [-seed n] [-threads n] [-out directory] [-heightfield] [-verify]
+// -verify reads a few chunks of every region back and compares them with freshly generated ones
+//
+// The world is generated one row of chunks at a time. Every step generates the terrain of one row
+// and decorates, compresses and queues the row two behind it, whose neighbours are done by then.
+// Only RING_ROWS rows are ever held uncompressed, so memory grows with the world's width, not its area
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Constants.h"
+#include "Region.h"
+#include "World.h"
+
+using PregenClock = std::chrono::steady_clock;
+
+constexpr size_t CHUNK_BLOCKS = size_t(CHUNK_SIZE) * WORLD_HEIGHT * CHUNK_SIZE;
+
+// rows being read by decoration (3) plus the row getting its terrain
+constexpr int RING_ROWS = 4;
+
+// compressed chunks waiting for the writer, generation stalls once this many pile up
+constexpr size_t MAX_QUEUED_CHUNKS = 4096;
+
+// TreeFeature stores block positions as int16_t
+constexpr int MAX_WORLD_SIZE = 32768;
+
+static double secondsSince(const PregenClock::time_point start)
+{
+    return std::chrono::duration<double>(PregenClock::now() - start).count();
+}
+
+// Loads the chunk back from its region and compares it with one generated on its own, which needs the
+// terrain of all 3x3 chunks around it for their trees. Returns false and says why if they differ
+static bool verifyChunk(const std::string& directory, const int chunkCount, const int chunkX, const int chunkZ)
+{
+    std::vector<uint8_t> blocks(10 * CHUNK_BLOCKS);
+    World::ChunkFeatures features[9];
+    const World::ChunkFeatures* neighbours[9];
+
+    const auto view = [&](const int buffer, const int x, const int z)
+    {
+        return World::ChunkView{ blocks.data() + buffer * CHUNK_BLOCKS, CHUNK_SIZE, CHUNK_SIZE * WORLD_HEIGHT, x * CHUNK_SIZE, z * CHUNK_SIZE };
+    };
+
+    for (int dz = -1; dz <= 1; dz++)
+        for (int dx = -1; dx <= 1; dx++)
+        {
+            const int i = (dx + 1) + (dz + 1) * 3;
+            const bool inside = chunkX + dx >= 0 && chunkZ + dz >= 0 && chunkX + dx < chunkCount && chunkZ + dz < chunkCount;
+
+            neighbours[i] = inside ? &features[i] : nullptr;
+            if (inside)
+                World::generateTerrainInto(chunkX + dx, chunkZ + dz, view(i, chunkX + dx, chunkZ + dz), features[i]);
+        }
+
+    const World::ChunkView expected = view(4, chunkX, chunkZ);
+    World::decorateInto(expected, neighbours);
+
+    const World::ChunkView loaded = view(9, chunkX, chunkZ);
+    if (!Region::loadChunk(directory, chunkX, chunkZ, loaded)) {
+        std::cout << "  chunk " << chunkX << ", " << chunkZ << " couldn't be read back\n";
+        return false;
+    }
+
+    if (memcmp(expected.blocks, loaded.blocks, CHUNK_BLOCKS) != 0) {
+        std::cout << "  chunk " << chunkX << ", " << chunkZ << " differs from a freshly generated one\n";
+        return false;
+    }
+
+    return true;
+}
+
+// persistent threads that run one batch of independent jobs at a time
+class WorkerPool
+{
+public:
+    explicit WorkerPool(const int threadCount)
+    {
+        for (int i = 0; i < threadCount; i++)
+            threads.emplace_back([this] { work(); });
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        started.notify_all();
+
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    // calls job(i) for every i in [0, count) and returns once they're all done
+    void run(const int count, const std::function<void(int)>& job)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        currentJob = &job;
+        jobCount = count;
+        nextJob = 0;
+        busyThreads = int(threads.size());
+        batch++;
+
+        started.notify_all();
+        finished.wait(lock, [this] { return busyThreads == 0; });
+    }
+
+private:
+    void work()
+    {
+        uint64_t lastBatch = 0;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                started.wait(lock, [&] { return stopping || batch != lastBatch; });
+
+                if (stopping)
+                    return;
+
+                lastBatch = batch;
+            }
+
+            for (int i = nextJob++; i < jobCount; i = nextJob++)
+                (*currentJob)(i);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyThreads == 0)
+                finished.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+
+    const std::function<void(int)>* currentJob = nullptr;
+    int jobCount = 0;
+    std::atomic<int> nextJob{ 0 };
+    int busyThreads = 0;
+    uint64_t batch = 0;
+    bool stopping = false;
+};
+
+struct CompressedChunk
+{
+    int chunkX, chunkZ;
+    std::vector<uint8_t> data;
+};
+
+// the last pipeline stage, a single thread appending chunks to their region files.
+// A region is closed as soon as all of its chunks are in
+class RegionWriter
+{
+public:
+    RegionWriter(std::string directory, const int chunkCount) : directory(std::move(directory)), chunkCount(chunkCount)
+    {
+        thread = std::thread([this] { work(); });
+    }
+
+    ~RegionWriter()
+    {
+        finish();
+    }
+
+    // writes out everything queued so far and closes the remaining regions
+    void finish()
+    {
+        if (!thread.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued.notify_one();
+
+        thread.join();
+    }
+
+    // blocks while the queue is full, so a slow disk can't make memory grow
+    void push(CompressedChunk&& chunk)
+    {
+        if (failed)
+            return;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        dequeued.wait(lock, [this] { return queue.size() < MAX_QUEUED_CHUNKS; });
+
+        queue.push_back(std::move(chunk));
+        queued.notify_one();
+    }
+
+    std::atomic<uint64_t> bytesWritten{ 0 };
+
+    // a region file couldn't be created or written, everything after that is dropped
+    std::atomic<bool> failed{ false };
+
+private:
+    struct OpenRegion
+    {
+        Region::RegionFile file;
+        int chunksLeft;
+    };
+
+    int regionChunks(const int region) const
+    {
+        return std::min(Region::REGION_CHUNKS, chunkCount - region * Region::REGION_CHUNKS);
+    }
+
+    void write(const CompressedChunk& chunk)
+    {
+        const int regionX = chunk.chunkX / Region::REGION_CHUNKS;
+        const int regionZ = chunk.chunkZ / Region::REGION_CHUNKS;
+
+        auto region = regions.find({ regionX, regionZ });
+        if (region == regions.end())
+        {
+            region = regions.emplace(std::make_pair(regionX, regionZ), OpenRegion()).first;
+
+            if (!region->second.file.open(directory, regionX, regionZ))
+            {
+                failed = true;
+                return;
+            }
+
+            region->second.chunksLeft = regionChunks(regionX) * regionChunks(regionZ);
+        }
+
+        if (!region->second.file.writeChunk(chunk.chunkX, chunk.chunkZ, chunk.data))
+        {
+            failed = true;
+            return;
+        }
+
+        bytesWritten += chunk.data.size();
+
+        if (--region->second.chunksLeft == 0)
+        {
+            if (!region->second.file.close())
+                failed = true;
+
+            regions.erase(region);
+        }
+    }
+
+    void work()
+    {
+        std::vector<CompressedChunk> batch;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queued.wait(lock, [this] { return stopping || !queue.empty(); });
+
+                if (queue.empty()) // only once stopping, everything queued before gets written
+                    return;
+
+                batch.swap(queue);
+            }
+            dequeued.notify_all();
+
+            for (const CompressedChunk& chunk : batch)
+                if (!failed)
+                    write(chunk);
+
+            batch.clear();
+        }
+    }
+
+    std::string directory;
+    int chunkCount;
+
+    std::map<std::pair<int, int>, OpenRegion> regions;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable dequeued;
+    std::vector<CompressedChunk> queue;
+    bool stopping = false;
+};
+
+int main(const int argc, const char** argv)
+{
+    int worldSize = 4096;
+    uint64_t seed = 18295169L;
+    int threadCount = std::max(1, int(std::thread::hardware_concurrency()));
+    std::string directory = "regions";
+    World::TerrainType terrain = World::TerrainType::Density;
+    bool verify = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const bool hasValue = i + 1 < argc;
+
+        if (strcmp(argv[i], "-size") == 0 && hasValue)
+            worldSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && hasValue)
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "-threads") == 0 && hasValue)
+            threadCount = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-out") == 0 && hasValue)
+            directory = argv[++i];
+        else if (strcmp(argv[i], "-heightfield") == 0)
+            terrain = World::TerrainType::Heightfield;
+        else if (strcmp(argv[i], "-verify") == 0)
+            verify = true;
+        else {
+            std::cout << "Usage: Pregen [-size blocks] [-seed n] [-threads n] [-out directory] [-heightfield] [-verify]\n";
+            return 1;
+        }
+    }
+
+    if (worldSize <= 0 || worldSize % CHUNK_SIZE != 0 || worldSize > MAX_WORLD_SIZE) {
+        std::cout << "World size must be a multiple of " << CHUNK_SIZE << " up to " << MAX_WORLD_SIZE << '\n';
+        return 1;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        std::cout << "Couldn't create " << directory << ": " << error.message() << '\n';
+        return 1;
+    }
+
+    World::GenParams params;
+    if (World::loadParams("res/worldgen.cfg", params))
+        World::setParams(params);
+
+    World::generateWorld(seed, terrain);
+
+    const int chunkCount = worldSize / CHUNK_SIZE;
+    const uint64_t totalChunks = uint64_t(chunkCount) * chunkCount;
+
+    std::vector<uint8_t> rows(RING_ROWS * chunkCount * CHUNK_BLOCKS);
+    std::vector<World::ChunkFeatures> features(RING_ROWS * chunkCount);
+
+    std::cout << "Generating " << worldSize << "x" << WORLD_HEIGHT << "x" << worldSize << " with seed " << seed
+              << " on " << threadCount << " thread(s) into " << directory << ", "
+              << rows.size() / (1024 * 1024) << " MB of chunk buffers\n";
+
+    const auto chunkView = [&](const int chunkX, const int chunkZ)
+    {
+        uint8_t* blocks = rows.data() + ((chunkZ % RING_ROWS) * chunkCount + chunkX) * CHUNK_BLOCKS;
+        return World::ChunkView{ blocks, CHUNK_SIZE, CHUNK_SIZE * WORLD_HEIGHT, chunkX * CHUNK_SIZE, chunkZ * CHUNK_SIZE };
+    };
+
+    const auto chunkFeatures = [&](const int chunkX, const int chunkZ) -> World::ChunkFeatures&
+    {
+        return features[(chunkZ % RING_ROWS) * chunkCount + chunkX];
+    };
+
+    RegionWriter writer(directory, chunkCount);
+    WorkerPool pool(threadCount);
+
+    std::atomic<uint64_t> chunksDone{ 0 };
+
+    const PregenClock::time_point start = PregenClock::now();
+    PregenClock::time_point lastReport = start;
+
+    for (int step = 0; step < chunkCount + 2 && !writer.failed; step++)
+    {
+        const int terrainRow = step;
+        const int decorationRow = step - 2;
+
+        const int terrainJobs = terrainRow < chunkCount ? chunkCount : 0;
+        const int decorationJobs = decorationRow >= 0 ? chunkCount : 0;
+
+        pool.run(terrainJobs + decorationJobs, [&](const int job)
+        {
+            if (job < terrainJobs) {
+                World::generateTerrainInto(job, terrainRow, chunkView(job, terrainRow), chunkFeatures(job, terrainRow));
+                return;
+            }
+
+            const int chunkX = job - terrainJobs;
+            const int chunkZ = decorationRow;
+
+            const World::ChunkFeatures* neighbours[9];
+            for (int dz = -1; dz <= 1; dz++)
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    const bool inside = chunkX + dx >= 0 && chunkZ + dz >= 0 && chunkX + dx < chunkCount && chunkZ + dz < chunkCount;
+                    neighbours[(dx + 1) + (dz + 1) * 3] = inside ? &chunkFeatures(chunkX + dx, chunkZ + dz) : nullptr;
+                }
+
+            const World::ChunkView chunk = chunkView(chunkX, chunkZ);
+            World::decorateInto(chunk, neighbours);
+
+            CompressedChunk compressed{ chunkX, chunkZ, {} };
+            Region::compressChunk(chunk, compressed.data);
+            writer.push(std::move(compressed));
+
+            chunksDone++;
+        });
+
+        if (secondsSince(lastReport) >= 1.0 || step == chunkCount + 1)
+        {
+            lastReport = PregenClock::now();
+
+            const double seconds = secondsSince(start);
+            const uint64_t done = chunksDone;
+            const double chunksPerSecond = done / seconds;
+
+            std::cout << "\r  " << done << " / " << totalChunks << " chunks (" << int(100.0 * done / totalChunks) << "%), "
+                      << int(chunksPerSecond) << " chunks/s, "
+                      << chunksPerSecond * CHUNK_BLOCKS / 1e6 << " Mvoxels/s, "
+                      << writer.bytesWritten / (1024 * 1024) << " MB written, "
+                      << int((totalChunks - done) / std::max(chunksPerSecond, 1.0)) << " s left   " << std::flush;
+        }
+    }
+
+    writer.finish();
+
+    if (writer.failed)
+    {
+        std::cout << "\nStopped, the world in " << directory << " is incomplete\n";
+        return 1;
+    }
+
+    std::cout << "\nDone in " << secondsSince(start) << " s, " << writer.bytesWritten / (1024 * 1024) << " MB in total\n";
+
+    if (verify)
+    {
+        // the middle chunk of every region and the world's corners, which have neighbours missing
+        std::vector<std::pair<int, int>> samples = {
+            { 0, 0 }, { chunkCount - 1, 0 }, { 0, chunkCount - 1 }, { chunkCount - 1, chunkCount - 1 }
+        };
+        for (int z = 0; z < chunkCount; z += Region::REGION_CHUNKS)
+            for (int x = 0; x < chunkCount; x += Region::REGION_CHUNKS)
+                samples.emplace_back(std::min(x + Region::REGION_CHUNKS / 2, chunkCount - 1), std::min(z + Region::REGION_CHUNKS / 2, chunkCount - 1));
+
+        std::atomic<int> mismatches{ 0 };
+        pool.run(int(samples.size()), [&](const int job)
+        {
+            if (!verifyChunk(directory, chunkCount, samples[job].first, samples[job].second))
+                mismatches++;
+        });
+
+        std::cout << "Verified " << samples.size() << " chunks, " << mismatches << " mismatch(es)\n";
+        if (mismatches > 0)
+            return 1;
+    }
+
+    return 0;
+}
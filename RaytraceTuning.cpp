@@ -0,0 +1,68 @@
+#include "RaytraceTuning.h"
+
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "AssetCache.h"
+#include "Shader.h"
+#include "Util.h"
+
+static uint64_t cacheKey()
+{
+    return hashBytes("raytrace layout", 15, driverHash());
+}
+
+RaytraceTuning::Layout RaytraceTuning::candidate(const int index)
+{
+    const int* shape = GROUP_SHAPES[index / ORDER_COUNT];
+    return { shape[0], shape[1], PixelOrder(index % ORDER_COUNT) };
+}
+
+std::string RaytraceTuning::defines(const Layout& layout)
+{
+    std::stringstream defines;
+    defines << "#define GROUP_WIDTH " << layout.groupWidth << "\n"
+            << "#define GROUP_HEIGHT " << layout.groupHeight << "\n";
+
+    if (layout.order != PixelOrder::Linear)
+        defines << "#define MORTON_ORDER\n";
+    if (layout.order == PixelOrder::Tiled)
+        defines << "#define TILE_GROUPS " << TILE_GROUPS << "\n";
+
+    return defines.str();
+}
+
+std::string RaytraceTuning::describe(const Layout& layout)
+{
+    static const char* orderNames[] = { "linear", "Morton", "tiled" };
+
+    return std::to_string(layout.groupWidth) + "x" + std::to_string(layout.groupHeight) + " " + orderNames[int(layout.order)];
+}
+
+bool RaytraceTuning::loadCached(Layout& layout)
+{
+    std::vector<uint8_t> cached;
+    if (!AssetCache::load(cacheKey(), cached) || cached.size() != sizeof(Layout))
+        return false;
+
+    Layout loaded;
+    memcpy(&loaded, cached.data(), sizeof(loaded));
+
+    // only ever hand out one of the candidates, whatever is on disk
+    for (int i = 0; i < CANDIDATE_COUNT; i++) {
+        const Layout known = candidate(i);
+
+        if (known.groupWidth == loaded.groupWidth && known.groupHeight == loaded.groupHeight && known.order == loaded.order) {
+            layout = known;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void RaytraceTuning::storeCached(const Layout& layout)
+{
+    AssetCache::store(cacheKey(), &layout, sizeof(layout));
+}
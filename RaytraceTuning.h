@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+
+// How the raytracer's invocations are laid out over the screen. DDA loops diverge as soon as rays in
+// one wave hit different things, so the shape of the pixels a wave covers matters as much as the work
+// group size. Which layout wins depends on the GPU, so the game times every candidate on the current
+// device once and caches the fastest per driver
+namespace RaytraceTuning
+{
+    enum class PixelOrder
+    {
+        Linear, // invocations go row by row through their work group
+        Morton, // Z-order inside the work group, a wave covers a square-ish block
+        Tiled   // Morton, and work groups run down columns TILE_GROUPS wide instead of across the screen
+    };
+
+    constexpr int TILE_GROUPS = 4;
+
+    struct Layout
+    {
+        int groupWidth;
+        int groupHeight;
+        PixelOrder order;
+    };
+
+    constexpr Layout DEFAULT_LAYOUT = { 16, 16, PixelOrder::Linear };
+
+    constexpr int GROUP_SHAPES[][2] = { { 8, 8 }, { 16, 16 }, { 32, 4 }, { 8, 4 } };
+    constexpr int SHAPE_COUNT = sizeof(GROUP_SHAPES) / sizeof(GROUP_SHAPES[0]);
+    constexpr int ORDER_COUNT = 3;
+    constexpr int CANDIDATE_COUNT = SHAPE_COUNT * ORDER_COUNT;
+
+    Layout candidate(int index);
+
+    // the work group size and pixel order defines for raytrace.comp
+    std::string defines(const Layout& layout);
+
+    std::string describe(const Layout& layout);
+
+    // false if this driver hasn't been tuned yet
+    bool loadCached(Layout& layout);
+    void storeCached(const Layout& layout);
+}
@@ -0,0 +1,168 @@
+#include "Region.h"
+
+#include <cstring>
+#include <iostream>
+
+struct RegionHeader
+{
+    char magic[8];
+    uint32_t chunkSize;
+    uint32_t worldHeight;
+    uint32_t regionChunks;
+    uint32_t padding;
+};
+
+constexpr char REGION_MAGIC[8] = "M4KREGN";
+
+constexpr int REGION_TABLE_ENTRIES = Region::REGION_CHUNKS * Region::REGION_CHUNKS;
+constexpr size_t REGION_TABLE_BYTES = REGION_TABLE_ENTRIES * 2 * sizeof(uint32_t);
+
+std::string Region::regionPath(const std::string& directory, const int regionX, const int regionZ)
+{
+    return directory + "/r." + std::to_string(regionX) + "." + std::to_string(regionZ) + ".m4kr";
+}
+
+static int tableIndex(const int chunkX, const int chunkZ)
+{
+    return (chunkX % Region::REGION_CHUNKS) + (chunkZ % Region::REGION_CHUNKS) * Region::REGION_CHUNKS;
+}
+
+// (run length - 1, block) pairs, columns top to bottom, x before z
+void Region::compressChunk(const World::ChunkView& chunk, std::vector<uint8_t>& compressed)
+{
+    compressed.clear();
+
+    for (int z = chunk.originZ; z < chunk.originZ + CHUNK_SIZE; z++) {
+        for (int x = chunk.originX; x < chunk.originX + CHUNK_SIZE; x++) {
+            int y = 0;
+
+            while (y < WORLD_HEIGHT) {
+                const uint8_t block = chunk.at(x, y, z);
+
+                int run = 1;
+                while (y + run < WORLD_HEIGHT && run < 256 && chunk.at(x, y + run, z) == block)
+                    run++;
+
+                compressed.push_back(uint8_t(run - 1));
+                compressed.push_back(block);
+
+                y += run;
+            }
+        }
+    }
+}
+
+bool Region::decompressChunk(const uint8_t* compressed, const size_t size, const World::ChunkView& chunk)
+{
+    size_t read = 0;
+
+    for (int z = chunk.originZ; z < chunk.originZ + CHUNK_SIZE; z++) {
+        for (int x = chunk.originX; x < chunk.originX + CHUNK_SIZE; x++) {
+            int y = 0;
+
+            while (y < WORLD_HEIGHT) {
+                if (read + 2 > size)
+                    return false;
+
+                const int run = compressed[read] + 1;
+                const uint8_t block = compressed[read + 1];
+                read += 2;
+
+                if (y + run > WORLD_HEIGHT)
+                    return false;
+
+                for (int i = 0; i < run; i++)
+                    chunk.at(x, y + i, z) = block;
+
+                y += run;
+            }
+        }
+    }
+
+    return read == size;
+}
+
+bool Region::loadChunk(const std::string& directory, const int chunkX, const int chunkZ, const World::ChunkView& chunk)
+{
+    std::ifstream file(regionPath(directory, chunkX / REGION_CHUNKS, chunkZ / REGION_CHUNKS), std::ios::binary);
+    if (!file)
+        return false;
+
+    RegionHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!file || memcmp(header.magic, REGION_MAGIC, sizeof(REGION_MAGIC)) != 0
+        || header.chunkSize != CHUNK_SIZE || header.worldHeight != WORLD_HEIGHT || header.regionChunks != REGION_CHUNKS)
+        return false;
+
+    uint32_t entry[2];
+    file.seekg(sizeof(RegionHeader) + tableIndex(chunkX, chunkZ) * sizeof(entry));
+    file.read(reinterpret_cast<char*>(entry), sizeof(entry));
+
+    if (!file || entry[0] == 0)
+        return false;
+
+    std::vector<uint8_t> compressed(entry[1]);
+    file.seekg(entry[0]);
+    file.read(reinterpret_cast<char*>(compressed.data()), compressed.size());
+
+    return file && decompressChunk(compressed.data(), compressed.size(), chunk);
+}
+
+bool Region::RegionFile::open(const std::string& directory, const int regionX, const int regionZ)
+{
+    path = regionPath(directory, regionX, regionZ);
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cout << "Couldn't create " << path << '\n';
+        return false;
+    }
+
+    table.assign(REGION_TABLE_ENTRIES * 2, 0);
+
+    // the table gets filled in on close, reserve its space for now
+    RegionHeader header = {};
+    memcpy(header.magic, REGION_MAGIC, sizeof(REGION_MAGIC));
+    header.chunkSize = CHUNK_SIZE;
+    header.worldHeight = WORLD_HEIGHT;
+    header.regionChunks = REGION_CHUNKS;
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(table.data()), REGION_TABLE_BYTES);
+
+    return bool(file);
+}
+
+bool Region::RegionFile::writeChunk(const int chunkX, const int chunkZ, const std::vector<uint8_t>& compressed)
+{
+    const int index = tableIndex(chunkX, chunkZ);
+
+    table[index * 2] = uint32_t(file.tellp());
+    table[index * 2 + 1] = uint32_t(compressed.size());
+
+    file.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+
+    if (!file) {
+        std::cout << "Couldn't write " << path << '\n';
+        return false;
+    }
+
+    return true;
+}
+
+bool Region::RegionFile::close()
+{
+    file.seekp(sizeof(RegionHeader));
+    file.write(reinterpret_cast<const char*>(table.data()), REGION_TABLE_BYTES);
+
+    // closing flushes whatever is still buffered, that can fail too
+    file.close();
+
+    if (!file) {
+        std::cout << "Couldn't write " << path << '\n';
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "World.h"
+
+// Region files hold REGION_CHUNKS x REGION_CHUNKS compressed chunks, for worlds too big to keep in memory.
+// A header and a table of (offset, size) per chunk come first, the chunks follow in the order they were written
+namespace Region
+{
+    constexpr int REGION_CHUNKS = 32;
+
+    // "<directory>/r.<regionX>.<regionZ>.m4kr"
+    std::string regionPath(const std::string& directory, int regionX, int regionZ);
+
+    // Run length encoded, one column at a time since columns are mostly long runs of air and stone
+    void compressChunk(const World::ChunkView& chunk, std::vector<uint8_t>& compressed);
+    bool decompressChunk(const uint8_t* compressed, size_t size, const World::ChunkView& chunk);
+
+    // reads one chunk back, false if the region or the chunk doesn't exist
+    bool loadChunk(const std::string& directory, int chunkX, int chunkZ, const World::ChunkView& chunk);
+
+    // Chunks can be added in any order. The table is only written on close
+    class RegionFile
+    {
+    public:
+        // all three return false once the file couldn't be written
+        bool open(const std::string& directory, int regionX, int regionZ); // truncates an existing file
+        bool writeChunk(int chunkX, int chunkZ, const std::vector<uint8_t>& compressed);
+        bool close();
+
+    private:
+        std::ofstream file;
+        std::string path;
+        std::vector<uint32_t> table; // offset and size of every chunk, zero for missing ones
+    };
+}
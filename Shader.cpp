@@ -1,13 +1,122 @@
 #include "Shader.h"
 
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <utility>
+#include <vector>
 
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/ext/matrix_transform.hpp>
 
+#include "AssetCache.h"
+#include "Util.h"
+
+// the binary formats the driver accepts, none means program binaries aren't supported
+static const std::vector<GLint>& binaryFormats()
+{
+    static const std::vector<GLint> formats = []
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+
+        std::vector<GLint> supported(count);
+        if (count > 0)
+            glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, supported.data());
+
+        return supported;
+    }();
+
+    return formats;
+}
+
+// a binary only loads on the driver that wrote it, so every key starts from the driver's strings.
+// A driver update then just misses instead of being handed binaries it will reject
+uint64_t driverHash()
+{
+    static const uint64_t hash = []
+    {
+        uint64_t driver = hashBytes("program", 7);
+
+        for (const GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION }) {
+            const char* value = reinterpret_cast<const char*>(glGetString(name));
+            if (value)
+                driver = hashBytes(value, strlen(value), driver);
+        }
+
+        return driver;
+    }();
+
+    return hash;
+}
+
+// cached programs are the binary format followed by the driver's binary
+static GLuint loadCachedProgram(const uint64_t key)
+{
+    const std::vector<GLint>& formats = binaryFormats();
+    if (formats.empty())
+        return 0;
+
+    std::vector<uint8_t> cached;
+    if (!AssetCache::load(key, cached) || cached.size() <= sizeof(GLenum))
+        return 0;
+
+    GLenum format;
+    memcpy(&format, cached.data(), sizeof(format));
+
+    if (std::find(formats.begin(), formats.end(), GLint(format)) == formats.end())
+        return 0;
+
+    const GLuint program = glCreateProgram();
+    glProgramBinary(program, format, cached.data() + sizeof(format), GLsizei(cached.size() - sizeof(format)));
+
+    // the driver is free to reject any binary, then it's compiled from source again and the entry replaced
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        std::cout << "Cached program was rejected by the driver, compiling from source... ";
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+// programs have to ask for a retrievable binary before linking
+static void linkProgram(const GLuint program)
+{
+    if (!binaryFormats().empty())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    glLinkProgram(program);
+}
+
+static void storeProgram(const GLuint program, const uint64_t key)
+{
+    if (binaryFormats().empty())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<uint8_t> binary(sizeof(GLenum) + length);
+
+    GLenum format;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data() + sizeof(format));
+    memcpy(binary.data(), &format, sizeof(format));
+
+    AssetCache::store(key, binary.data(), binary.size());
+}
+
+static uint64_t sourceKey(const std::string& source, const uint64_t hash = driverHash())
+{
+    return hashBytes(source.data(), source.size(), hash);
+}
+
 Shader::Shader(std::string vertexName, std::string fragmentName)
 {
     vertexName = "res/" + vertexName + ".vert";
@@ -41,6 +150,12 @@ Shader::Shader(std::string vertexName, std::string fragmentName)
         return;
     }
 
+    const uint64_t key = sourceKey(fragmentCode, sourceKey(vertexCode));
+
+    ID = loadCachedProgram(key);
+    if (ID != 0)
+        return;
+
     const char* vShaderCode = vertexCode.c_str();
     const char* fShaderCode = fragmentCode.c_str();
 
@@ -83,7 +198,7 @@ Shader::Shader(std::string vertexName, std::string fragmentName)
     glAttachShader(ID, vertex);
     glAttachShader(ID, fragment);
 
-    glLinkProgram(ID);
+    linkProgram(ID);
     
     // catch linking errors
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
@@ -97,6 +212,8 @@ Shader::Shader(std::string vertexName, std::string fragmentName)
     // delete the shaders as they're linked into our program now and no longer necessary
     glDeleteShader(vertex);
     glDeleteShader(fragment);
+
+    storeProgram(ID, key);
 }
 
 Shader::Shader(std::string computeName, HasExtra hasExtra, const char* extraCode)
@@ -126,6 +243,13 @@ Shader::Shader(std::string computeName, HasExtra hasExtra, const char* extraCode
     if(hasExtra == HasExtra::Yes)
         computeCode.insert(strlen("#version 430\n"), extraCode);
 
+    // the defines are part of the source by now, so they're part of the key too
+    const uint64_t key = sourceKey(computeCode);
+
+    ID = loadCachedProgram(key);
+    if (ID != 0)
+        return;
+
     const GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
 
     char const* computeSource = computeCode.c_str();
@@ -141,29 +265,41 @@ Shader::Shader(std::string computeName, HasExtra hasExtra, const char* extraCode
     {
         glGetShaderInfoLog(computeShader, 512, nullptr, infoLog);
         std::cout << "Failed to compile compute shader \"" << computeName << "\"! Error log:\n" << infoLog << std::endl;
+        glDeleteShader(computeShader);
         return;
     }
 
     // link the program
     ID = glCreateProgram();
     glAttachShader(ID, computeShader);
-    glLinkProgram(ID);
+    linkProgram(ID);
 
-    // catch errors
+    // catch errors, leaving ID at 0 so callers can tell
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
     if (!success)
     {
         glGetProgramInfoLog(ID, 512, nullptr, infoLog);
         std::cout << "Failed to link compute shader \"" << computeName << "\"! Error log:\n" << infoLog << std::endl;
+        glDeleteProgram(ID);
+        glDeleteShader(computeShader);
+        ID = 0;
         return;
     }
 
     glDetachShader(ID, computeShader);
     glDeleteShader(computeShader);
+
+    storeProgram(ID, key);
 }
 
 Shader::Shader(HasExtra, const std::string source)
 {
+    const uint64_t key = sourceKey(source);
+
+    ID = loadCachedProgram(key);
+    if (ID != 0)
+        return;
+
     const GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
 
     char const* computeSource = source.c_str();
@@ -185,7 +321,7 @@ Shader::Shader(HasExtra, const std::string source)
     // link the program
     ID = glCreateProgram();
     glAttachShader(ID, computeShader);
-    glLinkProgram(ID);
+    linkProgram(ID);
 
     // catch errors
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
@@ -198,6 +334,31 @@ Shader::Shader(HasExtra, const std::string source)
 
     glDetachShader(ID, computeShader);
     glDeleteShader(computeShader);
+
+    storeProgram(ID, key);
+}
+
+ShaderPermutations::ShaderPermutations(std::string computeName, std::string commonDefines)
+    : computeName(std::move(computeName)), commonDefines(std::move(commonDefines))
+{
+}
+
+const Shader& ShaderPermutations::get(const std::string& defines)
+{
+    const auto variant = variants.find(defines);
+    if (variant != variants.end())
+        return variant->second;
+
+    const std::string allDefines = commonDefines + defines;
+    Shader shader(computeName, HasExtra::Yes, allDefines.c_str());
+
+    // a broken variant isn't kept, the next time it's asked for it gets compiled again
+    if (shader.ID == 0) {
+        failed = std::move(shader);
+        return failed;
+    }
+
+    return variants.emplace(defines, std::move(shader)).first->second;
 }
 
 // use/activate the shader
@@ -205,6 +366,20 @@ void Shader::use() const {
     glUseProgram(ID);
 }
 
+UniformLocation Shader::uniform(const char* name, const bool optional) const
+{
+    const GLint location = glGetUniformLocation(ID, name);
+
+#ifdef _DEBUG
+    if (location == -1 && !optional)
+        std::cout << "Program " << ID << " has no uniform \"" << name << "\", setting it will do nothing\n";
+#else
+    (void)optional;
+#endif
+
+    return UniformLocation{ location };
+}
+
 // utility uniform functions
 void Shader::setBool(const std::string& name, const bool value) const {
     glUniform1i(getUniformLocation(name.c_str()), int(value));
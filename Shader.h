@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 
@@ -8,6 +9,35 @@
 
 enum class HasExtra {Yes, No};
 
+inline void setUniform(const GLint location, const bool value) { glUniform1i(location, int(value)); }
+inline void setUniform(const GLint location, const int value) { glUniform1i(location, value); }
+inline void setUniform(const GLint location, const float value) { glUniform1f(location, value); }
+inline void setUniform(const GLint location, const glm::vec2& value) { glUniform2fv(location, 1, &value[0]); }
+inline void setUniform(const GLint location, const glm::vec3& value) { glUniform3fv(location, 1, &value[0]); }
+inline void setUniform(const GLint location, const glm::vec4& value) { glUniform4fv(location, 1, &value[0]); }
+inline void setUniform(const GLint location, const glm::mat4& value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+
+// A uniform's location looked up once, setting it is a single glUniform call.
+// Only valid for the program it came from, and that program has to be in use
+template<typename T>
+class Uniform {
+public:
+    GLint location = -1;
+
+    Uniform() = default;
+    explicit Uniform(const GLint location) : location(location) {}
+
+    void set(const T& value) const { setUniform(location, value); }
+};
+
+// what Shader::uniform returns, turns into a Uniform of whichever type it's assigned to
+struct UniformLocation {
+    GLint location;
+
+    template<typename T>
+    operator Uniform<T>() const { return Uniform<T>(location); }
+};
+
 class Shader {
 public:
     GLuint ID = 0;
@@ -22,6 +52,10 @@ public:
 
     void use() const;
 
+    // resolves a uniform for a typed handle. Debug builds report names the program doesn't have,
+    // unless they're optional (used by some permutations only, or allowed to be optimized out)
+    UniformLocation uniform(const char* name, bool optional = false) const;
+
     // utility uniform functions
     void setBool(const std::string& name, bool value) const;
     // ------------------------------------------------------------------------
@@ -48,4 +82,28 @@ private:
     GLint getUniformLocation(const char* uniformName) const;
 
     mutable std::unordered_map<std::string, GLint> uniformCache;
-};
\ No newline at end of file
+};
+
+// One compute shader built for any number of #define sets, each the first time it's asked for.
+// Every variant is a separate program holding only the code its defines switch on,
+// so changing modes at runtime costs a compile (or a cached binary) instead of per-pixel branches.
+// Variants that fail to build aren't cached, so fixing the shader and switching modes again retries them
+class ShaderPermutations {
+public:
+    ShaderPermutations() = default;
+
+    // commonDefines go into every variant
+    ShaderPermutations(std::string computeName, std::string commonDefines);
+
+    const Shader& get(const std::string& defines);
+
+private:
+    std::string computeName;
+    std::string commonDefines;
+
+    std::unordered_map<std::string, Shader> variants;
+    Shader failed; // what get hands out for a variant that didn't build, ID 0
+};
+
+// a hash of the driver's vendor, renderer and version strings, for anything cached per driver
+uint64_t driverHash();
@@ -1,132 +1,246 @@
 #include "TextureGenerator.h"
 
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "AssetCache.h"
 #include "Constants.h"
 #include "Util.h"
 
-GLuint generateTextures(long long seed)
-{
-    // set random seed to generate textures
-    Random rand = Random(seed);
+// hash of the generator sources, filled in by CMake. Without it every build gets its own cache entries
+#ifndef TEXTURES_VERSION
+#define TEXTURES_VERSION __DATE__ " " __TIME__
+#endif
 
-    std::cout << "Building textures... ";
-    int* textureAtlas = new int[TEXTURE_RES * TEXTURE_RES * 3 * 16];
+// one tile of the atlas, its three faces stacked vertically: top, side, bottom.
+// Shapes (grass edge, bricks, wood rings, bark stripes) are laid out on the 16px grid and scaled up,
+// the noise is drawn per pixel so higher resolutions get finer detail rather than bigger pixels
+static constexpr void generateTile(const int blockID, const int res, Random& rand, int* textureAtlas)
+{
+    // size of one 16px pixel, 1 at the original resolution
+    const int scale = res / TEXTURE_RES;
 
-    // procedurally generates the 16x3 textureAtlas
     // gsd = grayscale detail
-    for (int blockID = 1; blockID < 16; blockID++) {
-        int gsd_tempA = 0xFF - rand.nextInt(0x60);
-
-        for (int y = 0; y < TEXTURE_RES * 3; y++) {
-            for (int x = 0; x < TEXTURE_RES; x++) {
-                // gets executed per pixel/texel
-
-                if (blockID != BLOCK_STONE || rand.nextInt(3) == 0) // if the block type is stone, update the noise value less often to get a stretched out look
-                    gsd_tempA = 0xFF - rand.nextInt(0x60);
-
-                int tint = 0x966C4A; // brown (dirt)
-                switch (blockID)
-                {
-                case BLOCK_STONE:
-                {
-                    tint = 0x7F7F7F; // grey
-                    break;
-                }
-                case BLOCK_GRASS:
-                {
-                    if (y < ((x * x * 3 + x * 81) >> 2 & 0x3) + (TEXTURE_RES * 1.125f)) // grass + grass edge
-                        tint = 0x6AAA40; // green
-                    else if (y < ((x * x * 3 + x * 81) >> 2 & 0x3) + (TEXTURE_RES * 1.1875f)) // grass edge shadow
-                        gsd_tempA = gsd_tempA * 2 / 3;
-                    break;
-                }
-                case BLOCK_WOOD:
-                {
-                    tint = 0x675231; // brown (bark)
-                    if (!(y >= TEXTURE_RES && y < TEXTURE_RES * 2) && // second row = stripes
-                        x > 0 && x < TEXTURE_RES - 1 &&
-                        ((y > 0 && y < TEXTURE_RES - 1) || (y > TEXTURE_RES * 2 && y < TEXTURE_RES * 3 - 1))) { // wood side area
-                        tint = 0xBC9862; // light brown
-
-                        // the following code repurposes 2 gsd variables making it a bit hard to read
-                        // but in short it gets the absolute distance from the tile's center in x and y direction 
-                        // finds the max of it
-                        // uses that to make the gray scale detail darker if the current pixel is part of an annual ring
-                        // and adds some noise as a finishing touch
-                        int woodCenter = TEXTURE_RES / 2 - 1;
-
-                        int dx = x - woodCenter;
-                        int dy = (y % TEXTURE_RES) - woodCenter;
-
-                        if (dx < 0)
-                            dx = 1 - dx;
-
-                        if (dy < 0)
-                            dy = 1 - dy;
-
-                        if (dy > dx)
-                            dx = dy;
-
-                        gsd_tempA = 196 - rand.nextInt(32) + dx % 3 * 32;
-                    }
-                    else if (rand.nextInt(2) == 0) {
-                        // make the gsd 50% brighter on random pixels of the bark
-                        // and 50% darker if x happens to be odd
-                        gsd_tempA = gsd_tempA * (150 - (x & 1) * 100) / 100;
-                    }
-                    break;
-                }
-                case BLOCK_BRICKS:
-                {
-                    tint = 0xB53A15; // red
-                    if ((x + y / 4 * 4) % 8 == 0 || y % 4 == 0) // gap between bricks
-                        tint = 0xBCAFA5; // reddish light grey
-                    break;
+    int gsd_tempA = 0xFF - rand.nextInt(0x60);
+
+    for (int y = 0; y < res * 3; y++) {
+        for (int x = 0; x < res; x++) {
+            // gets executed per pixel/texel
+
+            // position on the 16px grid
+            const int sx = x / scale;
+            const int sy = y / scale;
+
+            if (blockID != BLOCK_STONE || rand.nextInt(3) == 0) // if the block type is stone, update the noise value less often to get a stretched out look
+                gsd_tempA = 0xFF - rand.nextInt(0x60);
+
+            int tint = 0x966C4A; // brown (dirt)
+            switch (blockID)
+            {
+            case BLOCK_STONE:
+            {
+                tint = 0x7F7F7F; // grey
+                break;
+            }
+            case BLOCK_GRASS:
+            {
+                const int edge = ((sx * sx * 3 + sx * 81) >> 2 & 0x3) * scale;
+                if (y < edge + (res * 1.125f)) // grass + grass edge
+                    tint = 0x6AAA40; // green
+                else if (y < edge + (res * 1.1875f)) // grass edge shadow
+                    gsd_tempA = gsd_tempA * 2 / 3;
+                break;
+            }
+            case BLOCK_WOOD:
+            {
+                tint = 0x675231; // brown (bark)
+                if (!(sy >= TEXTURE_RES && sy < TEXTURE_RES * 2) && // second row = stripes
+                    sx > 0 && sx < TEXTURE_RES - 1 &&
+                    ((sy > 0 && sy < TEXTURE_RES - 1) || (sy > TEXTURE_RES * 2 && sy < TEXTURE_RES * 3 - 1))) { // wood side area
+                    tint = 0xBC9862; // light brown
+
+                    // the following code repurposes 2 gsd variables making it a bit hard to read
+                    // but in short it gets the absolute distance from the tile's center in x and y direction 
+                    // finds the max of it
+                    // uses that to make the gray scale detail darker if the current pixel is part of an annual ring
+                    // and adds some noise as a finishing touch
+                    int woodCenter = TEXTURE_RES / 2 - 1;
+
+                    int dx = sx - woodCenter;
+                    int dy = (sy % TEXTURE_RES) - woodCenter;
+
+                    if (dx < 0)
+                        dx = 1 - dx;
+
+                    if (dy < 0)
+                        dy = 1 - dy;
+
+                    if (dy > dx)
+                        dx = dy;
+
+                    gsd_tempA = 196 - rand.nextInt(32) + dx % 3 * 32;
                 }
+                else if (rand.nextInt(2) == 0) {
+                    // make the gsd 50% brighter on random pixels of the bark
+                    // and 50% darker if x happens to be odd
+                    gsd_tempA = gsd_tempA * (150 - (sx & 1) * 100) / 100;
                 }
+                break;
+            }
+            case BLOCK_BRICKS:
+            {
+                tint = 0xB53A15; // red
+                if ((sx + sy / 4 * 4) % 8 == 0 || sy % 4 == 0) // gap between bricks
+                    tint = 0xBCAFA5; // reddish light grey
+                break;
+            }
+            }
 
-                int gsd_constexpr = gsd_tempA;
-                if (y >= TEXTURE_RES * 2) // bottom side of the block
-                    gsd_constexpr /= 2; // make it darker, baked "shading"
+            int gsd_constexpr = gsd_tempA;
+            if (y >= res * 2) // bottom side of the block
+                gsd_constexpr /= 2; // make it darker, baked "shading"
 
-                if (blockID == BLOCK_LEAVES) {
-                    tint = 0x50D937; // green
-                    if (rand.nextInt(2) == 0) {
-                        tint = 0;
-                        gsd_constexpr = 0xFF;
-                    }
+            if (blockID == BLOCK_LEAVES) {
+                tint = 0x50D937; // green
+                if (rand.nextInt(2) == 0) {
+                    tint = 0;
+                    gsd_constexpr = 0xFF;
                 }
+            }
 
-                // multiply tint by the grayscale detail
-                const int col = ((tint & 0xFFFFFF) == 0 ? 0 : 0xFF) << 24 |
-                    (tint >> 16 & 0xFF) * gsd_constexpr / 0xFF << 16 |
-                    (tint >> 8 & 0xFF) * gsd_constexpr / 0xFF << 8 |
-                    (tint & 0xFF) * gsd_constexpr / 0xFF << 0;
+            // multiply tint by the grayscale detail
+            const int col = ((tint & 0xFFFFFF) == 0 ? 0 : 0xFF) << 24 |
+                (tint >> 16 & 0xFF) * gsd_constexpr / 0xFF << 16 |
+                (tint >> 8 & 0xFF) * gsd_constexpr / 0xFF << 8 |
+                (tint & 0xFF) * gsd_constexpr / 0xFF << 0;
 
-                // write pixel to the texture atlas
-                textureAtlas[x + (TEXTURE_RES * blockID) + y * (TEXTURE_RES * 16)] = col;
-            }
+            // write pixel to the texture atlas
+            textureAtlas[x + (res * blockID) + y * (res * 16)] = col;
         }
     }
+}
+
+constexpr int DEFAULT_ATLAS_SIZE = TEXTURE_RES * TEXTURE_RES * 3 * 16;
+
+// the original 16px atlas draws every tile from one random stream, in order.
+// Keeping that exact output means each tile's stream picks up where the previous one stopped
+static constexpr void generateClassicAtlas(const long long seed, int* atlas)
+{
+    Random rand = Random(seed);
+
+    for (int blockID = 1; blockID < 16; blockID++)
+        generateTile(blockID, TEXTURE_RES, rand, atlas);
+}
+
+static constexpr std::array<int, DEFAULT_ATLAS_SIZE> buildDefaultAtlas()
+{
+    std::array<int, DEFAULT_ATLAS_SIZE> atlas = {};
+    generateClassicAtlas(DEFAULT_TEXTURE_SEED, atlas.data());
+    return atlas;
+}
+
+// the game's own textures are baked into the binary, only other seeds and resolutions run at startup
+static constexpr std::array<int, DEFAULT_ATLAS_SIZE> defaultAtlas = buildDefaultAtlas();
+
+void buildTextureAtlas(const long long seed, const int resolution, std::vector<int>& atlas)
+{
+    if (seed == DEFAULT_TEXTURE_SEED && resolution == TEXTURE_RES) {
+        atlas.assign(defaultAtlas.begin(), defaultAtlas.end());
+        return;
+    }
+
+    atlas.assign(size_t(resolution) * resolution * 3 * 16, 0);
+
+    // cheap enough at this size to stay on one thread
+    if (resolution == TEXTURE_RES) {
+        generateClassicAtlas(seed, atlas.data());
+        return;
+    }
+
+    // larger tiles get their own stream derived from the seed and the block, and their own thread
+    std::vector<std::thread> threads;
+
+    for (int blockID = 1; blockID < 16; blockID++)
+        threads.emplace_back([=, &atlas]
+        {
+            Random rand = Random(uint64_t(seed) ^ uint64_t(blockID) * 0x9E3779B97F4A7C15ULL);
+            generateTile(blockID, resolution, rand, atlas.data());
+        });
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+GLuint generateTextures(const long long seed, const int resolution)
+{
+    std::cout << "Building " << resolution << "px textures... ";
+
+    const auto start = std::chrono::steady_clock::now();
+
+    const size_t atlasBytes = size_t(resolution) * resolution * 3 * 16 * sizeof(int);
+
+    uint64_t key = hashBytes(TEXTURES_VERSION, strlen(TEXTURES_VERSION));
+    key = hashBytes(&seed, sizeof(seed), key);
+    key = hashBytes(&resolution, sizeof(resolution), key);
+
+    // procedurally generates the 16x3 textureAtlas, unless an earlier run left it in the asset cache.
+    // The default atlas is compiled in, that's quicker than any file
+    std::vector<int> textureAtlas;
+    std::vector<uint8_t> cached;
+    const bool compiledIn = seed == DEFAULT_TEXTURE_SEED && resolution == TEXTURE_RES;
+
+    if (!compiledIn && AssetCache::load(key, cached) && cached.size() == atlasBytes) {
+        textureAtlas.resize(atlasBytes / sizeof(int));
+        memcpy(textureAtlas.data(), cached.data(), atlasBytes);
+
+        std::cout << "(cached) ";
+    }
+    else {
+        buildTextureAtlas(seed, resolution, textureAtlas);
+
+        if (!compiledIn)
+            AssetCache::store(key, textureAtlas.data(), atlasBytes);
+    }
 
-    GLuint textureAtlasTex = 0;
+    std::cout << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms. ";
 
-    std::cout << "Uploading texture atlas to GPU... ";
-    glGenTextures(1, &textureAtlasTex);
-    glBindTexture(GL_TEXTURE_2D, textureAtlasTex);
+    // the array has a layer per block and face, so mips never bleed between neighbouring tiles
+    int levels = 1;
+    while ((resolution >> levels) > 0)
+        levels++;
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    GLuint blockTextures = 0;
+
+    std::cout << "Uploading block textures to GPU... ";
+    glGenTextures(1, &blockTextures);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, blockTextures);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, resolution, resolution, 16 * 3);
+
+    // a tile's three faces are stacked in its atlas column, the unpack state cuts them out as three layers
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, resolution * 16);
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, resolution);
+
+    for (int blockID = 0; blockID < 16; blockID++) {
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, resolution * blockID);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, blockID * 3, resolution, resolution, 3, GL_BGRA, GL_UNSIGNED_BYTE, textureAtlas.data());
+    }
 
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, TEXTURE_RES * 16, TEXTURE_RES * 3);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TEXTURE_RES * 16, TEXTURE_RES * 3, GL_BGRA, GL_UNSIGNED_BYTE, textureAtlas);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 
-    delete[] textureAtlas;
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 
     std::cout << "Done!\n";
 
-    return textureAtlasTex;
+    return blockTextures;
 }
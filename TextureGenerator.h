@@ -1,4 +1,13 @@
 #pragma once
+#include <vector>
 #include <glad/glad.h>
 
-GLuint generateTextures(long long seed);
+// the seed of the game's textures, its 16px atlas is generated at compile time
+constexpr long long DEFAULT_TEXTURE_SEED = 151910774187927LL;
+
+// fills atlas with the 16x3 tile texture atlas, resolution pixels per tile side (a multiple of 16).
+// The atlas is resolution * 16 pixels wide and resolution * 3 tall, BGRA packed in an int
+void buildTextureAtlas(long long seed, int resolution, std::vector<int>& atlas);
+
+// a mipmapped GL_TEXTURE_2D_ARRAY, layer block * 3 + face with faces top, side, bottom
+GLuint generateTextures(long long seed, int resolution);
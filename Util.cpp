@@ -11,15 +11,19 @@ long long currentTime()
     return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
-uint64_t Random::seedUniquifier = 8682522807148012;
-Random::Random() : seed(uniqueSeed() ^ uint64_t(currentTime())) {}
-Random::Random(const uint64_t seed) : seed(initialScramble(seed)) {}
-
-uint64_t Random::initialScramble(const uint64_t seed)
+uint64_t hashBytes(const void* data, const size_t size, uint64_t hash)
 {
-    return (seed ^ multiplier) & mask;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+
+    return hash;
 }
 
+uint64_t Random::seedUniquifier = 8682522807148012;
+Random::Random() : seed(uniqueSeed() ^ uint64_t(currentTime())) {}
+
 uint64_t Random::uniqueSeed()
 {
     // L'Ecuyer, "Tables of Linear Congruential Generators of
@@ -35,18 +39,6 @@ uint64_t Random::uniqueSeed()
     }
 }
 
-int Random::next(const int bits)
-{
-    seed = (seed * multiplier + addend) & mask;
-    
-    return int(seed >> (48 - bits));
-}
-
-float Random::nextFloat()
-{
-    return float(next(24)) / float(1 << 24);
-}
-
 glm::vec2 Random::nextVec2(float magnitude)
 {
     float x = nextFloat() * magnitude * 2.f;
@@ -55,11 +47,6 @@ glm::vec2 Random::nextVec2(float magnitude)
     return glm::vec2(x - magnitude, y - magnitude);
 }
 
-uint32_t Random::nextInt()
-{
-    return next(32);
-}
-
 glm::ivec2 Random::nextIVec2(int magnitude)
 {
     int x = nextInt(magnitude * 2);
@@ -68,36 +55,13 @@ glm::ivec2 Random::nextIVec2(int magnitude)
     return glm::ivec2(x - magnitude, y - magnitude);
 }
 
-uint32_t Random::nextInt(const uint32_t bound)
-{
-    uint32_t r = next(31);
-    const uint32_t m = bound - 1;
-    if ((bound & m) == 0)  // i.e., bound is a power of 2
-        r = uint32_t(bound * uint64_t(r) >> 31);
-    else {
-        for (uint32_t u = r;
-            u - (r = u % bound) + m < 0;
-            u = next(31));
-    }
-    return r;
-}
-
-    uint64_t Random::nextLong() {
-        return ((uint64_t) (next(32)) << 32) + next(32);
-    }
-
-void Random::setSeed(const uint64_t newSeed)
-{
-    seed = initialScramble(newSeed);
-}
-
 // Perlin noise
 
 float scaled_cosine(const float i) {
     return 0.5f * (1.0f - std::cos(i * PI));
 }
 
-constexpr int PERLIN_RES = 1024;
+constexpr int PERLIN_RES = NoiseGenerator::RES;
 
 constexpr float PERLIN_OCTAVES = 4; // default to medium smooth
 constexpr float PERLIN_AMP_FALLOFF = 0.5f; // 50% reduction/octave
@@ -107,32 +71,29 @@ constexpr int PERLIN_YWRAP = 1 << PERLIN_YWRAPB;
 constexpr int PERLIN_ZWRAPB = 8;
 constexpr int PERLIN_ZWRAP = 1 << PERLIN_ZWRAPB;
 
-float perlin[PERLIN_RES + 1];
-
-float Perlin::noise(float x, float y) { // stolen from Processing
-    if (perlin[0] == 0) {
-        Random r = Random(18295169L);
-
-        for (float& i : perlin)
-            i = r.nextFloat();
-    }
+float NoiseGenerator::noise(float x, float y, float z) const { // stolen from Processing
+    const float* perlin = table;
 
     if (x < 0)
         x = -x;
     if (y < 0)
         y = -y;
+    if (z < 0)
+        z = -z;
 
     int xi = int(x);
     int yi = int(y);
+    int zi = int(z);
 
     float xf = x - xi;
     float yf = y - yi;
+    float zf = z - zi;
 
     float r = 0;
     float ampl = 0.5f;
 
     for (int i = 0; i < PERLIN_OCTAVES; i++) {
-        int of = xi + (yi << PERLIN_YWRAPB);
+        int of = xi + (yi << PERLIN_YWRAPB) + (zi << PERLIN_ZWRAPB);
 
         const float rxf = scaled_cosine(xf);
         const float ryf = scaled_cosine(yf);
@@ -150,7 +111,7 @@ float Perlin::noise(float x, float y) { // stolen from Processing
         n3 += rxf * (perlin[(of + PERLIN_YWRAP + 1) % PERLIN_RES] - n3);
         n2 += ryf * (n3 - n2);
 
-        n1 += scaled_cosine(0) * (n2 - n1);
+        n1 += scaled_cosine(zf) * (n2 - n1);
 
         r += n1 * ampl;
         ampl *= PERLIN_AMP_FALLOFF;
@@ -158,6 +119,8 @@ float Perlin::noise(float x, float y) { // stolen from Processing
         xf *= 2;
         yi <<= 1;
         yf *= 2;
+        zi <<= 1;
+        zf *= 2;
 
         if (xf >= 1.0) {
             xi++;
@@ -168,16 +131,32 @@ float Perlin::noise(float x, float y) { // stolen from Processing
             yi++;
             yf--;
         }
+
+        if (zf >= 1.0) {
+            zi++;
+            zf--;
+        }
     }
 
     return r;
 }
 
-float Perlin::noise(glm::vec2 pos)
+float NoiseGenerator::noise(float x, float y) const
+{
+    // the z lattice term collapses to nothing at z = 0
+    return noise(x, y, 0);
+}
+
+float NoiseGenerator::noise(glm::vec2 pos) const
 {
     return noise(pos.x, pos.y);
 }
 
+float NoiseGenerator::noise(glm::vec3 pos) const
+{
+    return noise(pos.x, pos.y, pos.z);
+}
+
 float clamp(float val, const float min, const float max)
 {
     if (min >= max)
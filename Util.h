@@ -9,6 +9,9 @@ constexpr float PI = 3.14159265359f;
 
 long long currentTime();
 
+// FNV-1a, pass the previous result as hash to chain several buffers
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL);
+
 // It's just the Java Random class
 class Random
 {
@@ -20,40 +23,90 @@ class Random
     constexpr static uint64_t addend = 0xBL;
     constexpr static uint64_t mask = (uint64_t(1) << 48) - 1;
 
-    static uint64_t initialScramble(const uint64_t seed);
+    constexpr static uint64_t initialScramble(const uint64_t seed)
+    {
+        return (seed ^ multiplier) & mask;
+    }
 
     static uint64_t uniqueSeed();
 
-    int next(int bits);
+    constexpr int next(const int bits)
+    {
+        seed = (seed * multiplier + addend) & mask;
+
+        return int(seed >> (48 - bits));
+    }
 
 public:
-    Random(uint64_t seed);
+    constexpr Random(const uint64_t seed) : seed(initialScramble(seed)) {}
 
     Random();
 
-    float nextFloat();
+    constexpr float nextFloat()
+    {
+        return float(next(24)) / float(1 << 24);
+    }
 
     glm::vec2 nextVec2(float magnitude);
 
 
-    uint32_t nextInt();
+    constexpr uint32_t nextInt()
+    {
+        return next(32);
+    }
 
     glm::ivec2 nextIVec2(int magnitude);
 
-    uint32_t nextInt(uint32_t bound);
+    constexpr uint32_t nextInt(const uint32_t bound)
+    {
+        uint32_t r = next(31);
+        const uint32_t m = bound - 1;
+        if ((bound & m) == 0)  // i.e., bound is a power of 2
+            r = uint32_t(bound * uint64_t(r) >> 31);
+        else // Java rejects when the signed sum overflows, the unsigned port never did
+            r %= bound;
+        return r;
+    }
+
+    constexpr uint64_t nextLong()
+    {
+        return (uint64_t(next(32)) << 32) + next(32);
+    }
+
+
+    constexpr void setSeed(const uint64_t newSeed)
+    {
+        seed = initialScramble(newSeed);
+    }
+};
+
+// It's just Perlin from Processing, with its own table per seed.
+// The table is filled in by the constructor and never changes after, so any
+// number of threads can sample the same generator
+class NoiseGenerator
+{
+public:
+    constexpr static int RES = 1024;
+
+    constexpr explicit NoiseGenerator(const uint64_t seed) : table()
+    {
+        Random r = Random(seed);
 
-    uint64_t nextLong();
+        for (float& i : table)
+            i = r.nextFloat();
+    }
 
+    float noise(glm::vec2 pos) const;
+    float noise(float x, float y) const;
+    float noise(glm::vec3 pos) const;
+    float noise(float x, float y, float z) const;
 
-    void setSeed(uint64_t newSeed);
-};
+    // RES + 1 floats, for the GPU port of noise()
+    const float* values() const { return table; }
 
-// It's just Perlin from Processing
-namespace Perlin
-{
-    float noise(glm::vec2 pos);
-    float noise(float x, float y);
-}
+private:
+    float table[RES + 1];
+};
 
 float clamp(float val, float min, float max);
 
@@ -1,16 +1,93 @@
 #include "World.h"
+#include "Biome.h"
 #include "Util.h"
+#include "WorldCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+uint8_t* World::world = new uint8_t[WORLD_SIZE * WORLD_HEIGHT * WORLD_SIZE]();
+
+// chunks move through these in order. Terrain only ever waits on nothing, decoration only on terrain
+enum class ChunkState : uint8_t { Missing, GeneratingTerrain, Terrain, Decorating, Ready };
+
+static uint64_t worldSeed = 0;
+static World::GenParams params;
+static NoiseGenerator terrainNoise = NoiseGenerator(0);
+static NoiseGenerator climateNoise = NoiseGenerator(0);
+static const char* diskCacheDirectory = nullptr;
+static World::TerrainType worldTerrain = World::TerrainType::Density;
+static std::atomic<ChunkState> chunkStates[CHUNK_COUNT * CHUNK_COUNT];
+static std::atomic<uint32_t> chunkRevisions[CHUNK_COUNT * CHUNK_COUNT];
+static std::atomic<uint32_t> chunkBorderRevisions[CHUNK_COUNT * CHUNK_COUNT];
+static World::ChunkFeatures chunkFeatures[CHUNK_COUNT * CHUNK_COUNT]; // written once, before the chunk reaches Terrain
+static std::atomic<uint32_t> chunksFromCache{ 0 };
+static std::atomic<uint32_t> chunksGenerated{ 0 };
+
+static std::mutex generatedMutex;
+static std::vector<glm::ivec2> generatedChunks;
+
+// background generation
+static std::vector<std::thread> workers;
+static std::mutex requestMutex;
+static std::condition_variable requestCondition;
+static std::vector<glm::ivec2> requestedChunks; // nearest last, so workers pop from the back
+static bool stopWorkers = false;
+
+// raw access for the generator, which must not trigger chunk generation itself
+static void setBlockRaw(const int x, const int y, const int z, const uint8_t block)
+{
+    World::world[x + y * WORLD_SIZE + z * WORLD_SIZE * WORLD_HEIGHT] = block;
+}
+
+static uint8_t getBlockRaw(const int x, const int y, const int z)
+{
+    return World::world[x + y * WORLD_SIZE + z * WORLD_SIZE * WORLD_HEIGHT];
+}
 
-uint8_t* World::world = new uint8_t[WORLD_SIZE * WORLD_HEIGHT * WORLD_SIZE];
+static void generateChunkTerrain(int chunkX, int chunkZ, const World::ChunkView& chunk, Random& rand, World::ChunkFeatures& features);
+static void placeTree(const World::TreeFeature& tree, const World::ChunkView& chunk);
+
+// the part of the world array that holds this chunk
+static World::ChunkView worldChunk(const int chunkX, const int chunkZ)
+{
+    const int x = chunkX * CHUNK_SIZE;
+    const int z = chunkZ * CHUNK_SIZE;
+
+    return { World::world + x + z * WORLD_SIZE * WORLD_HEIGHT, WORLD_SIZE, WORLD_SIZE * WORLD_HEIGHT, x, z };
+}
 
 void World::setBlock(const int x, const int y, const int z, const uint8_t block)
 {
-    world[x + y * WORLD_SIZE + z * WORLD_SIZE * WORLD_HEIGHT] = block;
+    if (!isChunkGenerated(x / CHUNK_SIZE, z / CHUNK_SIZE))
+        generateChunk(x / CHUNK_SIZE, z / CHUNK_SIZE);
+
+    // writing what's already there changes nothing, so caches built from the chunk stay valid
+    if (getBlockRaw(x, y, z) == block)
+        return;
+
+    setBlockRaw(x, y, z, block);
+
+    const int chunk = x / CHUNK_SIZE + z / CHUNK_SIZE * CHUNK_COUNT;
+    const bool onBorder = x % CHUNK_SIZE == 0 || x % CHUNK_SIZE == CHUNK_SIZE - 1 || z % CHUNK_SIZE == 0 || z % CHUNK_SIZE == CHUNK_SIZE - 1;
+
+    if (onBorder)
+        chunkBorderRevisions[chunk].fetch_add(1, std::memory_order_release);
+    chunkRevisions[chunk].fetch_add(1, std::memory_order_release);
 }
 
 uint8_t World::getBlock(const int x, const int y, const int z)
 {
-    return world[x + y * WORLD_SIZE + z * WORLD_SIZE * WORLD_HEIGHT];
+    if (!isChunkGenerated(x / CHUNK_SIZE, z / CHUNK_SIZE))
+        generateChunk(x / CHUNK_SIZE, z / CHUNK_SIZE);
+
+    return getBlockRaw(x, y, z);
 }
 
 uint8_t World::getBlock(const glm::vec3& pos)
@@ -34,16 +111,281 @@ void World::fillBox(const uint8_t blockId, const glm::vec3& pos0,
             for (int z = pos0.z; z < pos1.z; z++)
             {
                 if (!replace) {
-                    if (getBlock(x, y, z) != BLOCK_AIR)
+                    if (getBlockRaw(x, y, z) != BLOCK_AIR)
                         continue;
                 }
 
-                setBlock(x, y, z, blockId);
+                setBlockRaw(x, y, z, blockId);
             }
         }
     }
 }
 
+uint32_t World::getChunkRevision(const int chunkX, const int chunkZ)
+{
+    return chunkRevisions[chunkX + chunkZ * CHUNK_COUNT].load(std::memory_order_acquire);
+}
+
+uint32_t World::getChunkBorderRevision(const int chunkX, const int chunkZ)
+{
+    return chunkBorderRevisions[chunkX + chunkZ * CHUNK_COUNT].load(std::memory_order_acquire);
+}
+
+bool World::isChunkGenerated(const int chunkX, const int chunkZ)
+{
+    return chunkStates[chunkX + chunkZ * CHUNK_COUNT].load(std::memory_order_acquire) == ChunkState::Ready;
+}
+
+static bool isWithinChunks(const int chunkX, const int chunkZ)
+{
+    return chunkX >= 0 && chunkZ >= 0 && chunkX < CHUNK_COUNT && chunkZ < CHUNK_COUNT;
+}
+
+static void waitForState(const std::atomic<ChunkState>& state, const ChunkState target)
+{
+    while (state.load(std::memory_order_acquire) < target)
+        std::this_thread::yield();
+}
+
+static void finishChunk(const int chunkX, const int chunkZ)
+{
+    chunkRevisions[chunkX + chunkZ * CHUNK_COUNT].fetch_add(1, std::memory_order_relaxed);
+    chunkBorderRevisions[chunkX + chunkZ * CHUNK_COUNT].fetch_add(1, std::memory_order_relaxed);
+    chunkStates[chunkX + chunkZ * CHUNK_COUNT].store(ChunkState::Ready, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(generatedMutex);
+    generatedChunks.emplace_back(chunkX, chunkZ);
+}
+
+// makes sure the chunk has at least terrain and planned features
+static void ensureTerrain(const int chunkX, const int chunkZ)
+{
+    std::atomic<ChunkState>& state = chunkStates[chunkX + chunkZ * CHUNK_COUNT];
+
+    ChunkState expected = ChunkState::Missing;
+    if (!state.compare_exchange_strong(expected, ChunkState::GeneratingTerrain, std::memory_order_acquire))
+    {
+        // another thread got here first, wait for it rather than generating twice
+        waitForState(state, ChunkState::Terrain);
+        return;
+    }
+
+    World::ChunkFeatures& features = chunkFeatures[chunkX + chunkZ * CHUNK_COUNT];
+
+    // cached chunks come back fully decorated, along with the features their neighbours need
+    if (WorldCache::loadChunk(chunkX, chunkZ, World::world, features))
+    {
+        chunksFromCache.fetch_add(1, std::memory_order_relaxed);
+        finishChunk(chunkX, chunkZ);
+        return;
+    }
+
+    World::generateTerrainInto(chunkX, chunkZ, worldChunk(chunkX, chunkZ), features);
+
+    state.store(ChunkState::Terrain, std::memory_order_release);
+}
+
+// Every chunk writes only its own blocks, so neighbours can decorate in parallel without locks.
+// Neighbours are visited in ascending world order, which makes overlapping trees come out the same on both sides of a border
+static void decorateChunk(const int chunkX, const int chunkZ)
+{
+    const World::ChunkFeatures* neighbours[9];
+
+    for (int dz = -1; dz <= 1; dz++)
+        for (int dx = -1; dx <= 1; dx++)
+            neighbours[(dx + 1) + (dz + 1) * 3] = isWithinChunks(chunkX + dx, chunkZ + dz)
+                                                ? &chunkFeatures[(chunkX + dx) + (chunkZ + dz) * CHUNK_COUNT]
+                                                : nullptr;
+
+    World::decorateInto(worldChunk(chunkX, chunkZ), neighbours);
+}
+
+void World::generateTerrainInto(const int chunkX, const int chunkZ, const ChunkView& chunk, ChunkFeatures& features)
+{
+    // every chunk gets its own random stream, so the result doesn't depend on generation order
+    Random rand = Random(worldSeed ^ (uint64_t(chunkX) * 341873128712L + uint64_t(chunkZ) * 132897987541L));
+
+    features.treeCount = 0;
+    generateChunkTerrain(chunkX, chunkZ, chunk, rand, features);
+}
+
+void World::decorateInto(const ChunkView& chunk, const ChunkFeatures* const neighbours[9])
+{
+    for (int i = 0; i < 9; i++)
+    {
+        if (!neighbours[i])
+            continue;
+
+        for (int tree = 0; tree < neighbours[i]->treeCount; tree++)
+            placeTree(neighbours[i]->trees[tree], chunk);
+    }
+}
+
+void World::generateChunk(const int chunkX, const int chunkZ)
+{
+    std::atomic<ChunkState>& state = chunkStates[chunkX + chunkZ * CHUNK_COUNT];
+
+    if (state.load(std::memory_order_acquire) == ChunkState::Ready)
+        return;
+
+    // features can reach across the border, so all 8 neighbours need their terrain and plans first
+    for (int dz = -1; dz <= 1; dz++)
+        for (int dx = -1; dx <= 1; dx++)
+            if (isWithinChunks(chunkX + dx, chunkZ + dz))
+                ensureTerrain(chunkX + dx, chunkZ + dz);
+
+    ChunkState expected = ChunkState::Terrain;
+    if (!state.compare_exchange_strong(expected, ChunkState::Decorating, std::memory_order_acquire))
+    {
+        waitForState(state, ChunkState::Ready);
+        return;
+    }
+
+    decorateChunk(chunkX, chunkZ);
+    chunksGenerated.fetch_add(1, std::memory_order_relaxed);
+
+    WorldCache::storeChunk(chunkX, chunkZ, world, chunkFeatures[chunkX + chunkZ * CHUNK_COUNT]);
+
+    finishChunk(chunkX, chunkZ);
+}
+
+// chunk offsets sorted by distance, rebuilt only when the radius changes. Not thread safe
+static const std::vector<glm::ivec2>& chunkOffsetsByDistance(const float radius)
+{
+    static std::vector<glm::ivec2> spiral;
+    static float spiralRadius = -1.0f;
+
+    if (radius != spiralRadius)
+    {
+        const int chunkRadius = int(radius / CHUNK_SIZE) + 1;
+
+        spiral.clear();
+        for (int dx = -chunkRadius; dx <= chunkRadius; dx++)
+            for (int dz = -chunkRadius; dz <= chunkRadius; dz++)
+                spiral.emplace_back(dx, dz);
+
+        std::sort(spiral.begin(), spiral.end(), [](const glm::ivec2& a, const glm::ivec2& b)
+        {
+            return a.x * a.x + a.y * a.y < b.x * b.x + b.y * b.y;
+        });
+
+        spiralRadius = radius;
+    }
+
+    return spiral;
+}
+
+// missing chunks within radius of center, nearest first
+static void collectMissingChunks(const glm::vec3& center, const float radius, std::vector<glm::ivec2>& chunks)
+{
+    const glm::ivec2 centerChunk = glm::ivec2(int(center.x) / CHUNK_SIZE, int(center.z) / CHUNK_SIZE);
+
+    for (const glm::ivec2& offset : chunkOffsetsByDistance(radius))
+    {
+        const glm::ivec2 chunk = centerChunk + offset;
+        if (chunk.x < 0 || chunk.y < 0 || chunk.x >= CHUNK_COUNT || chunk.y >= CHUNK_COUNT)
+            continue;
+
+        if (chunkStates[chunk.x + chunk.y * CHUNK_COUNT].load(std::memory_order_relaxed) >= ChunkState::Decorating)
+            continue;
+
+        // skip chunks whose closest column is out of reach
+        const glm::vec2 closest = glm::clamp(glm::vec2(center.x, center.z),
+                                             glm::vec2(chunk * CHUNK_SIZE),
+                                             glm::vec2((chunk + 1) * CHUNK_SIZE));
+        if (glm::distance(closest, glm::vec2(center.x, center.z)) > radius)
+            continue;
+
+        chunks.push_back(chunk);
+    }
+}
+
+void World::generateNearby(const glm::vec3& center, const float radius, const int maxChunks)
+{
+    static std::vector<glm::ivec2> missing;
+
+    missing.clear();
+    collectMissingChunks(center, radius, missing);
+
+    for (int i = 0; i < int(missing.size()) && i < maxChunks; i++)
+        generateChunk(missing[i].x, missing[i].y);
+}
+
+static void generationWorker()
+{
+    for (;;)
+    {
+        glm::ivec2 chunk;
+
+        {
+            std::unique_lock<std::mutex> lock(requestMutex);
+            requestCondition.wait(lock, [] { return stopWorkers || !requestedChunks.empty(); });
+
+            if (stopWorkers)
+                return;
+
+            chunk = requestedChunks.back();
+            requestedChunks.pop_back();
+        }
+
+        World::generateChunk(chunk.x, chunk.y);
+    }
+}
+
+void World::startGenerationThreads(const int count)
+{
+    stopWorkers = false;
+
+    for (int i = 0; i < count; i++)
+        workers.emplace_back(generationWorker);
+}
+
+void World::stopGenerationThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        stopWorkers = true;
+        requestedChunks.clear();
+    }
+    requestCondition.notify_all();
+
+    for (std::thread& worker : workers)
+        worker.join();
+
+    workers.clear();
+}
+
+int World::requestNearby(const glm::vec3& center, const float radius)
+{
+    static std::vector<glm::ivec2> missing;
+
+    missing.clear();
+    collectMissingChunks(center, radius, missing);
+
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        requestedChunks.assign(missing.rbegin(), missing.rend());
+    }
+
+    if (!missing.empty())
+        requestCondition.notify_all();
+
+    return int(missing.size());
+}
+
+void World::takeGeneratedChunks(std::vector<glm::ivec2>& chunks)
+{
+    std::lock_guard<std::mutex> lock(generatedMutex);
+
+    chunks.insert(chunks.end(), generatedChunks.begin(), generatedChunks.end());
+    generatedChunks.clear();
+}
+
+void World::enableDiskCache(const char* directory)
+{
+    diskCacheDirectory = directory;
+}
+
 void World::generateWorld()
 {
     Random rand;
@@ -52,118 +394,432 @@ void World::generateWorld()
     generateWorld(seed);
 }
 
-constexpr float maxTerrainHeight = WORLD_HEIGHT / 2.0f;
+static void resetChunks()
+{
+    for (std::atomic<ChunkState>& state : chunkStates)
+        state.store(ChunkState::Missing);
+
+    chunksFromCache.store(0, std::memory_order_relaxed);
+    chunksGenerated.store(0, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(generatedMutex);
+        generatedChunks.clear();
+    }
+
+    // every parameter set has a cache file of its own, so going back to earlier values finds theirs again
+    if (diskCacheDirectory)
+        WorldCache::open(diskCacheDirectory, worldSeed, int(worldTerrain), hashBytes(&params, sizeof(params)));
+    else
+        WorldCache::close();
+}
+
+void World::generateWorld(const uint64_t seed, const TerrainType terrain)
+{
+    worldSeed = seed;
+    worldTerrain = terrain;
+
+    // the noise tables are read only from here on, so worker threads can share them
+    terrainNoise = NoiseGenerator(seed);
+    climateNoise = NoiseGenerator(seed ^ 0x5DEECE66DULL);
+
+    resetChunks();
+}
+
+bool World::loadParams(const char* path, GenParams& params)
+{
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    // the generator divides by the positive ones, 0 or less would turn the noise coordinates into inf or NaN
+    const struct { const char* name; float* value; bool positive; } floatParams[] = {
+        { "maxTerrainHeight", &params.maxTerrainHeight, false },
+        { "horizontalScale", &params.horizontalScale, true },
+        { "heightAmplitude", &params.heightAmplitude, false },
+        { "verticalScale", &params.verticalScale, true },
+        { "densityFalloff", &params.densityFalloff, true },
+        { "densityAmplitude", &params.densityAmplitude, false },
+        { "caveScale", &params.caveScale, true },
+        { "caveWidth", &params.caveWidth, false },
+        { "caveStrength", &params.caveStrength, false },
+    };
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        // everything after a # is a comment
+        line = line.substr(0, line.find('#'));
+
+        const size_t equals = line.find('=');
+        if (equals == std::string::npos)
+            continue;
+
+        std::string name;
+        std::stringstream(line.substr(0, equals)) >> name;
+
+        std::stringstream valueStream(line.substr(equals + 1));
+
+        if (name == "stoneDepth") {
+            valueStream >> params.stoneDepth;
+            continue;
+        }
+
+        bool known = false;
+        for (const auto& param : floatParams)
+        {
+            if (name != param.name)
+                continue;
+
+            known = true;
+
+            float value = 0.0f;
+            if (!(valueStream >> value) || !std::isfinite(value) || (param.positive && value <= 0.0f)) {
+                std::cout << "Ignoring " << name << " in " << path << ", it has to be a" << (param.positive ? " positive" : "") << " number\n";
+                continue;
+            }
+
+            *param.value = value;
+        }
+
+        if (!known)
+            std::cout << "Unknown worldgen parameter \"" << name << "\" in " << path << '\n';
+    }
+
+    return true;
+}
+
+void World::setParams(const GenParams& newParams)
+{
+    params = newParams;
+
+    resetChunks();
+}
+
+World::GenerationStats World::generationStats()
+{
+    return { chunksFromCache.load(std::memory_order_relaxed), chunksGenerated.load(std::memory_order_relaxed) };
+}
+
+const World::GenParams& World::getParams()
+{
+    return params;
+}
+
+World::TerrainType World::getTerrainType()
+{
+    return worldTerrain;
+}
+
+const NoiseGenerator& World::getTerrainNoise()
+{
+    return terrainNoise;
+}
+
+const NoiseGenerator& World::getClimateNoise()
+{
+    return climateNoise;
+}
+
+static bool isWithinChunk(const int x, const int z, const World::ChunkView& chunk)
+{
+    return x >= chunk.originX && z >= chunk.originZ && x < chunk.originX + CHUNK_SIZE && z < chunk.originZ + CHUNK_SIZE;
+}
+
+// fillBox without replacing, limited to the chunk
+static void fillLeavesClipped(const glm::ivec3& pos0, const glm::ivec3& pos1, const World::ChunkView& chunk)
+{
+    for (int x = glm::max(pos0.x, chunk.originX); x < glm::min(pos1.x, chunk.originX + CHUNK_SIZE); x++)
+        for (int y = pos0.y; y < pos1.y; y++)
+            for (int z = glm::max(pos0.z, chunk.originZ); z < glm::min(pos1.z, chunk.originZ + CHUNK_SIZE); z++)
+                if (chunk.at(x, y, z) == BLOCK_AIR)
+                    chunk.at(x, y, z) = BLOCK_LEAVES;
+}
+
+static void setBlockClipped(const int x, const int y, const int z, const uint8_t block, const World::ChunkView& chunk)
+{
+    if (isWithinChunk(x, z, chunk))
+        chunk.at(x, y, z) = block;
+}
+
+// writes the part of the tree that falls within the chunk
+static void placeTree(const World::TreeFeature& tree, const World::ChunkView& chunk)
+{
+    const int terrainHeight = tree.groundY;
+    const int trunkHeight = tree.trunkHeight;
+
+    // fill trunk
+    if (isWithinChunk(tree.x, tree.z, chunk))
+    {
+        for (int y = terrainHeight; y >= terrainHeight - trunkHeight; y--)
+            chunk.at(tree.x, y, tree.z) = BLOCK_WOOD;
+    }
+
+    // fill base foliage
+    fillLeavesClipped(glm::ivec3(tree.x - 2, terrainHeight - trunkHeight + 1, tree.z - 2),
+                      glm::ivec3(tree.x + 3, terrainHeight - trunkHeight + 3, tree.z + 3), chunk);
+
+    // fill crown
+    fillLeavesClipped(glm::ivec3(tree.x - 1, terrainHeight - trunkHeight - 1, tree.z - 1),
+                      glm::ivec3(tree.x + 2, terrainHeight - trunkHeight + 1, tree.z + 2), chunk);
 
-#ifdef CLASSIC // classic worldgen
-void World::generateWorld(uint64_t seed)
+    // cut out corners
+    for (int i = 0; i < 4; i++)
+    {
+        // binary counting, so we cover all values
+        const int bit0 = (i >> 0 & 0b01) * 2 - 1;
+        const int bit1 = (i >> 1 & 0b01) * 2 - 1;
+
+        // base foliage
+        const glm::ivec2 foliagePos = glm::ivec2(tree.x + (2 * bit0), tree.z + (2 * bit1));
+
+        int cornerStyle = tree.foliageCorners[i];
+
+        if ((cornerStyle == 0) || (cornerStyle == 2)) // cut out top
+            setBlockClipped(foliagePos.s, terrainHeight - trunkHeight + 1, foliagePos.t, BLOCK_AIR, chunk);
+
+        if ((cornerStyle == 1) || (cornerStyle == 2)) // cut out bottom
+            setBlockClipped(foliagePos.s, terrainHeight - trunkHeight + 2, foliagePos.t, BLOCK_AIR, chunk);
+
+        // crown
+        const glm::ivec2 crownPos = glm::ivec2(tree.x + bit0, tree.z + bit1);
+
+        cornerStyle = tree.crownCorners[i];
+
+        if (cornerStyle == 0) // cut out bottom 1/10 times
+            setBlockClipped(crownPos.s, terrainHeight - trunkHeight, crownPos.t, BLOCK_AIR, chunk);
+
+        // always cut crown top
+        setBlockClipped(crownPos.s, terrainHeight - trunkHeight - 1, crownPos.t, BLOCK_AIR, chunk);
+    }
+}
+
+#ifdef CLASSIC // classic worldgen, no features
+static void generateChunkTerrain(const int chunkX, const int chunkZ, const World::ChunkView& chunk, Random& rand, World::ChunkFeatures&)
 {
-    Random rand = Random(seed);
-    for (int x = WORLD_SIZE; x >= 0; x--) {
+    for (int x = chunkX * CHUNK_SIZE; x < (chunkX + 1) * CHUNK_SIZE; x++) {
         for (int y = 0; y < WORLD_HEIGHT; y++) {
-            for (int z = 0; z < WORLD_SIZE; z++) {
+            for (int z = chunkZ * CHUNK_SIZE; z < (chunkZ + 1) * CHUNK_SIZE; z++) {
                 uint8_t block;
 
-                if (y > maxTerrainHeight + rand.nextInt(8))
+                if (y > params.maxTerrainHeight + rand.nextInt(8))
                     block = rand.nextInt(8) + 1;
                 else
                     block = BLOCK_AIR;
 
-                if (x == WORLD_SIZE)
-                    continue;
-
-                setBlock(x, y, z, block);
+                chunk.at(x, y, z) = block;
             }
         }
     }
 }
 #else // new worldgen
-constexpr int stoneDepth = 5;
-
-void World::generateWorld(uint64_t seed)
+// one noise sample per column
+static void generateHeightfield(const int chunkX, const int chunkZ, const World::ChunkView& chunk, const ClimateMap& climate)
 {
-    Random rand = Random(seed);
+    for (int x = chunkX * CHUNK_SIZE; x < (chunkX + 1) * CHUNK_SIZE; x++) {
+        for (int z = chunkZ * CHUNK_SIZE; z < (chunkZ + 1) * CHUNK_SIZE; z++) {
+            const int localX = x - chunkX * CHUNK_SIZE;
+            const int localZ = z - chunkZ * CHUNK_SIZE;
 
-    for (int x = WORLD_SIZE; x >= 0; x--) {
-        for (int z = 0; z < WORLD_SIZE; z++) {
-            const int terrainHeight = round(maxTerrainHeight + Perlin::noise(x / 32.f, z / 32.f) * 10.0f);
+            const Biome& biome = climate.biome(localX, localZ);
+            const float heightScale = climate.heightScaleAt(localX, localZ);
+
+            // noise averages 0.5, scale around that so the mean height stays put
+            const float noise = terrainNoise.noise(x / params.horizontalScale, z / params.horizontalScale);
+            const int terrainHeight = round(params.maxTerrainHeight + (0.5f + (noise - 0.5f) * heightScale) * params.heightAmplitude);
 
             for (int y = 0; y < WORLD_HEIGHT; y++) {
                 uint8_t block;
 
-                if (y > terrainHeight + stoneDepth)
+                if (y > terrainHeight + params.stoneDepth)
                     block = BLOCK_STONE;
                 else if (y > terrainHeight)
-                    block = BLOCK_DEFAULT_DIRT;
+                    block = biome.subsurfaceBlock;
                 else if (y == terrainHeight)
-                    block = BLOCK_GRASS;
+                    block = biome.surfaceBlock;
                 else
                     block = BLOCK_AIR;
 
-                setBlock(x, y, z, block);
+                chunk.at(x, y, z) = block;
             }
         }
     }
+}
 
-    // populate trees
-    for (int x = 4; x < WORLD_SIZE - 4; x += 8) {
-        for (int z = 4; z < WORLD_SIZE - 4; z += 8) {
-            if (rand.nextInt(4) == 0) // spawn tree
-            {
-                const glm::vec2 treePos = rand.nextIVec2(2) + glm::ivec2(x, z);
+// 3D density is only sampled every LATTICE_X x LATTICE_Y x LATTICE_Z blocks and trilinearly interpolated in between
+constexpr int LATTICE_X = 4;
+constexpr int LATTICE_Y = 8;
+constexpr int LATTICE_Z = 4;
 
-                const int terrainHeight = int(round(maxTerrainHeight + Perlin::noise(treePos / 32.f) * 10.0f)) - 1;
-                const int trunkHeight = 4 + rand.nextInt(2); // min 4 max 5
+constexpr int LATTICE_POINTS_X = CHUNK_SIZE / LATTICE_X + 1;
+constexpr int LATTICE_POINTS_Y = WORLD_HEIGHT / LATTICE_Y + 1;
+constexpr int LATTICE_POINTS_Z = CHUNK_SIZE / LATTICE_Z + 1;
 
-                // fill trunk
-                for (int y = terrainHeight; y >= terrainHeight - trunkHeight; y--)
-                {
-                    setBlock(treePos.s, y, treePos.t, BLOCK_WOOD);
-                }
+// the lattice and the climate map share their x and z samples
+static_assert(LATTICE_X == CLIMATE_STEP && LATTICE_Z == CLIMATE_STEP, "density lattice must line up with the climate map");
 
-                // fill base foliage
-                fillBox(BLOCK_LEAVES,
-                    glm::vec3(treePos.s - 2, terrainHeight - trunkHeight + 1, treePos.t - 2),
-                    glm::vec3(treePos.s + 3, terrainHeight - trunkHeight + 3, treePos.t + 3), false);
+// positive is solid. y grows downwards, so density increases with y
+static float sampleDensity(const float x, const float y, const float z, const float heightScale)
+{
+    // the noise pushes the surface around in all 3 axes, which makes overhangs
+    const float noise = terrainNoise.noise(x / params.horizontalScale, y / params.verticalScale, z / params.horizontalScale);
+    float density = (y - params.maxTerrainHeight) / params.densityFalloff + (noise - 0.5f) * params.densityAmplitude * heightScale;
 
-                // fill crown
-                fillBox(BLOCK_LEAVES,
-                    glm::vec3(treePos.s - 1, terrainHeight - trunkHeight - 1, treePos.t - 1),
-                    glm::vec3(treePos.s + 2, terrainHeight - trunkHeight + 1, treePos.t + 2), false);
+    // tunnels follow the midpoint of a second noise field
+    const float caveNoise = terrainNoise.noise(x / params.caveScale + 512, y / (params.caveScale / 2), z / params.caveScale + 512);
+    const float cave = params.caveWidth - std::abs(caveNoise - 0.5f);
+    if (cave > 0)
+        density -= cave * params.caveStrength;
 
-                // cut out corners randomly
-                for (int i = 0; i < 4; i++)
-                {
-                    // binary counting, so we cover all values
-                    int bit0 = (i >> 0 & 0b01) * 2 - 1;
-                    int bit1 = (i >> 1 & 0b01) * 2 - 1;
+    return density;
+}
 
+static void generateDensity(const int chunkX, const int chunkZ, const World::ChunkView& chunk, const ClimateMap& climate)
+{
+    const int baseX = chunkX * CHUNK_SIZE;
+    const int baseZ = chunkZ * CHUNK_SIZE;
 
-                    // base foliage
-                    const glm::ivec2 foliagePos = glm::ivec2(treePos.s + (2 * bit0), treePos.t + (2 * bit1));
+    float lattice[LATTICE_POINTS_X][LATTICE_POINTS_Y][LATTICE_POINTS_Z];
 
+    for (int lx = 0; lx < LATTICE_POINTS_X; lx++)
+        for (int ly = 0; ly < LATTICE_POINTS_Y; ly++)
+            for (int lz = 0; lz < LATTICE_POINTS_Z; lz++)
+                lattice[lx][ly][lz] = sampleDensity(float(baseX + lx * LATTICE_X),
+                                                    float(ly * LATTICE_Y),
+                                                    float(baseZ + lz * LATTICE_Z),
+                                                    climate.heightScale[lx][lz]);
 
-                    int cornerStyle = rand.nextInt(7);
+    for (int x = 0; x < CHUNK_SIZE; x++) {
+        const int lx = x / LATTICE_X;
+        const float fx = float(x % LATTICE_X) / LATTICE_X;
 
-                    if ((cornerStyle == 0) || (cornerStyle == 2)) // cut out top
-                       setBlock(foliagePos.s, terrainHeight - trunkHeight + 1, foliagePos.t, BLOCK_AIR);
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            const int lz = z / LATTICE_Z;
+            const float fz = float(z % LATTICE_Z) / LATTICE_Z;
 
-                    if ((cornerStyle == 1) || (cornerStyle == 2)) // cut out bottom
-                        setBlock(foliagePos.s, terrainHeight - trunkHeight + 2, foliagePos.t, BLOCK_AIR);
+            const Biome& biome = climate.biome(x, z);
 
+            // interpolate along x and z once per column, which leaves a single lerp per block
+            float column[LATTICE_POINTS_Y];
+            for (int ly = 0; ly < LATTICE_POINTS_Y; ly++)
+                column[ly] = glm::mix(glm::mix(lattice[lx][ly][lz],     lattice[lx + 1][ly][lz],     fx),
+                                      glm::mix(lattice[lx][ly][lz + 1], lattice[lx + 1][ly][lz + 1], fx), fz);
 
-                    // crown
-                    const glm::ivec2 crownPos = glm::ivec2(treePos.s + bit0, treePos.t + bit1);
+            // blocks since the last air block, to paint grass and dirt on every surface including overhangs
+            int depth = -1;
 
-                    cornerStyle = rand.nextInt(5);
+            for (int y = 0; y < WORLD_HEIGHT; y++) {
+                const int ly = y / LATTICE_Y;
+                const float fy = float(y % LATTICE_Y) / LATTICE_Y;
+
+                const float density = glm::mix(column[ly], column[ly + 1], fy);
 
-                    if (cornerStyle == 0) // cut out bottom 1/10 times
-                        setBlock(crownPos.s, terrainHeight - trunkHeight, crownPos.t, BLOCK_AIR);
+                uint8_t block = BLOCK_AIR;
 
-                    // always cut crown top
-                    setBlock(crownPos.s, terrainHeight - trunkHeight - 1, crownPos.t, BLOCK_AIR);
+                if (density > 0 || y == WORLD_HEIGHT - 1) { // keep a floor under the world
+                    depth++;
+
+                    if (depth > params.stoneDepth)
+                        block = BLOCK_STONE;
+                    else if (depth > 0)
+                        block = biome.subsurfaceBlock;
+                    else
+                        block = biome.surfaceBlock;
+                }
+                else {
+                    depth = -1;
                 }
+
+                chunk.at(baseX + x, y, baseZ + z) = block;
             }
         }
     }
 }
-#endif
\ No newline at end of file
+
+// one tree cell every 8 blocks, the trunk can stand anywhere in it
+static void planTrees(const int chunkX, const int chunkZ, const World::ChunkView& chunk, const ClimateMap& climate, Random& rand, World::ChunkFeatures& features)
+{
+    for (int cellX = 0; cellX < CHUNK_SIZE; cellX += 8) {
+        for (int cellZ = 0; cellZ < CHUNK_SIZE; cellZ += 8) {
+            const int treeChance = climate.biome(cellX + 4, cellZ + 4).treeChance;
+
+            if (treeChance > 0 && rand.nextInt(treeChance) == 0) // spawn tree
+            {
+                const int x = chunkX * CHUNK_SIZE + cellX + rand.nextInt(8);
+                const int z = chunkZ * CHUNK_SIZE + cellZ + rand.nextInt(8);
+
+                // grow from the topmost block of the column, which is grass on open ground.
+                // Only this chunk's terrain is read, nobody else writes it before it decorates
+                int surface = 0;
+                while (surface < WORLD_HEIGHT && chunk.at(x, surface, z) == BLOCK_AIR)
+                    surface++;
+
+                if (surface == WORLD_HEIGHT || chunk.at(x, surface, z) != BLOCK_GRASS)
+                    continue;
+
+                const int terrainHeight = surface - 1;
+                const int trunkHeight = 4 + rand.nextInt(2); // min 4 max 5
+
+                if (terrainHeight - trunkHeight - 1 < 0) // no room below the sky limit
+                    continue;
+
+                World::TreeFeature& tree = features.trees[features.treeCount++];
+                tree.x = int16_t(x);
+                tree.z = int16_t(z);
+                tree.groundY = int8_t(terrainHeight);
+                tree.trunkHeight = uint8_t(trunkHeight);
+
+                for (int i = 0; i < 4; i++)
+                {
+                    tree.foliageCorners[i] = uint8_t(rand.nextInt(7));
+                    tree.crownCorners[i] = uint8_t(rand.nextInt(5));
+                }
+            }
+        }
+    }
+}
+
+// Climate only depends on the seed, so every chunk of the world keeps its map
+// across parameter reloads and regenerates with the same one
+struct CachedClimate
+{
+    bool built = false;
+    uint64_t seed = 0;
+    ClimateMap map;
+};
+
+static CachedClimate chunkClimates[CHUNK_COUNT * CHUNK_COUNT]; // only touched by the thread generating the chunk's terrain
+
+// chunks past the world edge (Pregen's) aren't kept, they get scratch filled in instead
+static const ClimateMap& chunkClimate(const int chunkX, const int chunkZ, ClimateMap& scratch)
+{
+    if (!isWithinChunks(chunkX, chunkZ)) {
+        scratch.generate(chunkX, chunkZ, climateNoise);
+        return scratch;
+    }
+
+    CachedClimate& cached = chunkClimates[chunkX + chunkZ * CHUNK_COUNT];
+
+    if (!cached.built || cached.seed != worldSeed) {
+        cached.map.generate(chunkX, chunkZ, climateNoise);
+        cached.seed = worldSeed;
+        cached.built = true;
+    }
+
+    return cached.map;
+}
+
+static void generateChunkTerrain(const int chunkX, const int chunkZ, const World::ChunkView& chunk, Random& rand, World::ChunkFeatures& features)
+{
+    // every pass looks the climate up here instead of sampling the noise again
+    ClimateMap scratch;
+    const ClimateMap& climate = chunkClimate(chunkX, chunkZ, scratch);
+
+    if (worldTerrain == World::TerrainType::Density)
+        generateDensity(chunkX, chunkZ, chunk, climate);
+    else
+        generateHeightfield(chunkX, chunkZ, chunk, climate);
+
+    planTrees(chunkX, chunkZ, chunk, climate, rand, features);
+}
+#endif
@@ -1,6 +1,11 @@
 #pragma once
+#include <vector>
+#include <glm/vec2.hpp>
+
 #include "Constants.h"
 
+class NoiseGenerator;
+
 namespace World
 {
     extern uint8_t* world;
@@ -16,6 +21,122 @@ namespace World
     void fillBox(uint8_t blockId, const glm::vec3& pos0,
         const glm::vec3& pos1, bool replace);
 
+    // A tree planned by the chunk its trunk stands in, with every random choice already made.
+    // Features may reach into the neighbouring chunks, but no further
+    struct TreeFeature
+    {
+        int16_t x, z;               // trunk position in world coordinates
+        int8_t groundY;             // block above the ground, the trunk grows up (towards -y) from here
+        uint8_t trunkHeight;
+        uint8_t foliageCorners[4];  // how each corner of the base foliage gets cut
+        uint8_t crownCorners[4];    // same for the crown
+    };
+
+    constexpr int MAX_TREES_PER_CHUNK = (CHUNK_SIZE / 8) * (CHUNK_SIZE / 8);
+    constexpr int FEATURE_REACH = 2; // how far past the trunk a tree writes blocks
+
+    static_assert(FEATURE_REACH < CHUNK_SIZE, "features must stay within the 3x3 chunk neighbourhood");
+
+    struct ChunkFeatures
+    {
+        uint8_t treeCount;
+        TreeFeature trees[MAX_TREES_PER_CHUNK];
+    };
+
+    // One chunk's blocks, wherever they are stored. Positions are in world coordinates
+    struct ChunkView
+    {
+        uint8_t* blocks;        // the chunk's first block
+        int strideY, strideZ;
+        int originX, originZ;   // world position of blocks[0]
+
+        uint8_t& at(const int x, const int y, const int z) const
+        {
+            return blocks[(x - originX) + y * strideY + (z - originZ) * strideZ];
+        }
+    };
+
+    // The generator by itself, for tools that build worlds bigger than the world array.
+    // Neither touches the world array or the chunk states, so any number of threads can run them once the seed is set.
+    // Chunk coordinates can go past CHUNK_COUNT, as long as block positions fit the int16_t of TreeFeature
+    void generateTerrainInto(int chunkX, int chunkZ, const ChunkView& chunk, ChunkFeatures& features);
+    // neighbours are the features of the 3x3 chunks around this one, row by row from -z, null past the world edge
+    void decorateInto(const ChunkView& chunk, const ChunkFeatures* const neighbours[9]);
+
+    // Chunks are CHUNK_SIZE x WORLD_HEIGHT x CHUNK_SIZE columns, generated the first time something touches them.
+    // Terrain comes first. Once all 8 neighbours have terrain, a chunk is decorated with every feature
+    // of its 3x3 neighbourhood, clipped to the chunk itself, so decoration only ever writes its own chunk
+    bool isChunkGenerated(int chunkX, int chunkZ);
+    void generateChunk(int chunkX, int chunkZ); // terrain and decoration, does nothing if the chunk already exists
+
+    // changes whenever setBlock or the generator writes the chunk, so caches built from its blocks know to rebuild
+    uint32_t getChunkRevision(int chunkX, int chunkZ);
+    // the same, but only for blocks in the chunk's outermost columns, which are all its neighbours can see of it
+    uint32_t getChunkBorderRevision(int chunkX, int chunkZ);
+
+    // generate up to maxChunks missing chunks within radius of center, nearest first
+    void generateNearby(const glm::vec3& center, float radius, int maxChunks);
+
+    // background generation: worker threads pick up requested chunks, nearest first
+    void startGenerationThreads(int count);
+    void stopGenerationThreads();
+    // replaces the previous request, returns how many chunks in range aren't generated yet
+    int requestNearby(const glm::vec3& center, float radius);
+
+    // where the chunks since the last generateWorld or setParams came from
+    struct GenerationStats
+    {
+        uint32_t fromCache;
+        uint32_t generated;
+    };
+    GenerationStats generationStats();
+
+    // chunks generated since the last call, so they can be uploaded to the GPU
+    void takeGeneratedChunks(std::vector<glm::ivec2>& chunks);
+
+    // Tunable generator parameters, loaded from res/worldgen.cfg
+    struct GenParams
+    {
+        float maxTerrainHeight = WORLD_HEIGHT / 2.0f; // mean ground level, y grows downwards
+        int stoneDepth = 5;                           // dirt layers between the surface and stone
+
+        float horizontalScale = 32.0f; // blocks per terrain noise unit on x and z
+        float heightAmplitude = 10.0f; // heightfield hill height at a height scale of 1
+
+        float verticalScale = 16.0f;   // blocks per density noise unit on y
+        float densityFalloff = 8.0f;   // blocks over which density goes from air to solid around the mean height
+        float densityAmplitude = 4.0f; // how far the 3D noise pushes the surface around
+
+        float caveScale = 20.0f;    // blocks per cave noise unit, half that on y
+        float caveWidth = 0.1f;     // noise band around the midpoint that turns into tunnels
+        float caveStrength = 40.0f;
+    };
+
+    // Reads key = value lines into params, keys that aren't in the file keep their value
+    bool loadParams(const char* path, GenParams& params);
+
+    // Switches to new parameters. Every chunk is marked for regeneration but keeps its old blocks
+    // until then, so the ones near the camera get replaced first and the rest only when visited.
+    // Don't call with threads running
+    void setParams(const GenParams& params);
+
+    enum class TerrainType
+    {
+        Heightfield, // 2D noise, one sample per column
+        Density      // 3D noise on a coarse lattice, with caves and overhangs
+    };
+
+    // the generator's current state, for the GPU port of the terrain pass
+    const GenParams& getParams();
+    TerrainType getTerrainType();
+    const NoiseGenerator& getTerrainNoise();
+    const NoiseGenerator& getClimateNoise();
+
+    // cache generated chunks in this directory, keyed by seed. Takes effect on the next generateWorld
+    void enableDiskCache(const char* directory);
+
     void generateWorld(); // randomize seed
-    void generateWorld(uint64_t seed);
-}
\ No newline at end of file
+    // only sets the seed, chunks are generated on demand. Don't call with threads running.
+    // The terrain type is ignored by the CLASSIC generator
+    void generateWorld(uint64_t seed, TerrainType terrain = TerrainType::Density);
+}
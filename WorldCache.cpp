@@ -0,0 +1,201 @@
+#include "WorldCache.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Constants.h"
+#include "Util.h"
+
+// hash of the generator sources, filled in by CMake. Without it every build gets its own cache
+#ifndef WORLDGEN_VERSION
+#define WORLDGEN_VERSION __DATE__ " " __TIME__
+#endif
+
+struct CacheHeader
+{
+    char magic[8];
+    uint64_t seed;
+    uint64_t generatorVersion;
+    uint32_t worldSize;
+    uint32_t worldHeight;
+    uint32_t chunkSize;
+    uint32_t terrainType;
+    uint32_t chunkBytes; // catches layout changes of the cached features
+    uint32_t padding;
+};
+
+constexpr char CACHE_MAGIC[8] = "M4KWGEN";
+
+constexpr size_t CHUNK_BLOCKS = size_t(CHUNK_SIZE) * WORLD_HEIGHT * CHUNK_SIZE;
+constexpr size_t CHUNK_BYTES = sizeof(World::ChunkFeatures) + CHUNK_BLOCKS;
+
+// header, then one "cached" byte per chunk, then the chunks themselves: features followed by the blocks in x, y, z order
+constexpr size_t FLAGS_OFFSET = sizeof(CacheHeader);
+constexpr size_t CHUNKS_OFFSET = FLAGS_OFFSET + CHUNK_COUNT * CHUNK_COUNT;
+constexpr size_t CACHE_SIZE = CHUNKS_OFFSET + CHUNK_BYTES * CHUNK_COUNT * CHUNK_COUNT;
+
+static uint8_t* mapping = nullptr;
+
+#ifdef _WIN32
+static HANDLE fileHandle = INVALID_HANDLE_VALUE;
+static HANDLE mappingHandle = nullptr;
+#else
+static int fileDescriptor = -1;
+#endif
+
+static bool mapFile(const std::string& path)
+{
+#ifdef _WIN32
+    fileHandle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READWRITE,
+                                       DWORD(uint64_t(CACHE_SIZE) >> 32), DWORD(CACHE_SIZE & 0xFFFFFFFF), nullptr);
+    if (!mappingHandle)
+        return false;
+
+    mapping = static_cast<uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, CACHE_SIZE));
+#else
+    fileDescriptor = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fileDescriptor < 0)
+        return false;
+
+    // grows the file to its full size, unwritten chunks stay sparse
+    if (ftruncate(fileDescriptor, off_t(CACHE_SIZE)) != 0)
+        return false;
+
+    void* address = mmap(nullptr, CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    mapping = address == MAP_FAILED ? nullptr : static_cast<uint8_t*>(address);
+#endif
+
+    return mapping != nullptr;
+}
+
+static void unmapFile()
+{
+#ifdef _WIN32
+    if (mapping)
+        UnmapViewOfFile(mapping);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(fileHandle);
+
+    mappingHandle = nullptr;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (mapping)
+        munmap(mapping, CACHE_SIZE);
+    if (fileDescriptor >= 0)
+        ::close(fileDescriptor);
+
+    fileDescriptor = -1;
+#endif
+
+    mapping = nullptr;
+}
+
+bool WorldCache::open(const char* directory, const uint64_t seed, const int terrainType, const uint64_t paramsHash)
+{
+    close();
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    char paramsName[32];
+    snprintf(paramsName, sizeof(paramsName), "%016llx", static_cast<unsigned long long>(paramsHash));
+
+    const std::string path = std::string(directory) + "/world_" + std::to_string(seed) + "_" + std::to_string(terrainType) + "_" + paramsName + ".bin";
+
+    if (!mapFile(path))
+    {
+        std::cout << "Couldn't map world cache \"" << path << "\", generating without it\n";
+        unmapFile();
+        return false;
+    }
+
+    CacheHeader expected{};
+    memcpy(expected.magic, CACHE_MAGIC, sizeof(expected.magic));
+    expected.seed = seed;
+    expected.generatorVersion = hashBytes(WORLDGEN_VERSION, strlen(WORLDGEN_VERSION), paramsHash);
+    expected.worldSize = WORLD_SIZE;
+    expected.worldHeight = WORLD_HEIGHT;
+    expected.chunkSize = CHUNK_SIZE;
+    expected.terrainType = uint32_t(terrainType);
+    expected.chunkBytes = uint32_t(CHUNK_BYTES);
+
+    // new file, other generator or other dimensions: start over. Other parameters have their own file
+    if (memcmp(mapping, &expected, sizeof(CacheHeader)) != 0)
+    {
+        memset(mapping + FLAGS_OFFSET, 0, CHUNK_COUNT * CHUNK_COUNT);
+        memcpy(mapping, &expected, sizeof(CacheHeader));
+    }
+
+    return true;
+}
+
+void WorldCache::close()
+{
+    unmapFile();
+}
+
+bool WorldCache::isOpen()
+{
+    return mapping != nullptr;
+}
+
+bool WorldCache::loadChunk(const int chunkX, const int chunkZ, uint8_t* world, World::ChunkFeatures& features)
+{
+    if (!mapping || !mapping[FLAGS_OFFSET + chunkX + chunkZ * CHUNK_COUNT])
+        return false;
+
+    const uint8_t* slot = mapping + CHUNKS_OFFSET + CHUNK_BYTES * (chunkX + chunkZ * CHUNK_COUNT);
+    memcpy(&features, slot, sizeof(World::ChunkFeatures));
+
+    const uint8_t* chunk = slot + sizeof(World::ChunkFeatures);
+
+    // chunk rows are CHUNK_SIZE bytes apart here and WORLD_SIZE apart in the world
+    for (int z = 0; z < CHUNK_SIZE; z++)
+        for (int y = 0; y < WORLD_HEIGHT; y++)
+            memcpy(world + chunkX * CHUNK_SIZE + y * WORLD_SIZE + (chunkZ * CHUNK_SIZE + z) * WORLD_SIZE * WORLD_HEIGHT,
+                   chunk + (y + z * WORLD_HEIGHT) * CHUNK_SIZE,
+                   CHUNK_SIZE);
+
+    return true;
+}
+
+void WorldCache::storeChunk(const int chunkX, const int chunkZ, const uint8_t* world, const World::ChunkFeatures& features)
+{
+    if (!mapping)
+        return;
+
+    uint8_t* slot = mapping + CHUNKS_OFFSET + CHUNK_BYTES * (chunkX + chunkZ * CHUNK_COUNT);
+    memcpy(slot, &features, sizeof(World::ChunkFeatures));
+
+    uint8_t* chunk = slot + sizeof(World::ChunkFeatures);
+
+    for (int z = 0; z < CHUNK_SIZE; z++)
+        for (int y = 0; y < WORLD_HEIGHT; y++)
+            memcpy(chunk + (y + z * WORLD_HEIGHT) * CHUNK_SIZE,
+                   world + chunkX * CHUNK_SIZE + y * WORLD_SIZE + (chunkZ * CHUNK_SIZE + z) * WORLD_SIZE * WORLD_HEIGHT,
+                   CHUNK_SIZE);
+
+    // flag goes in last, so a chunk interrupted mid copy isn't marked as cached
+    std::atomic_thread_fence(std::memory_order_release);
+    mapping[FLAGS_OFFSET + chunkX + chunkZ * CHUNK_COUNT] = 1;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+
+#include "World.h"
+
+// Generated chunks cached on disk, so restarting with the same seed skips worldgen.
+// One memory mapped file per (seed, terrain type, generator parameters), so tweaking the parameters
+// and going back finds the old chunks again. The header records the generator version and
+// world dimensions, and a mismatch throws the whole file away
+namespace WorldCache
+{
+    // maps the cache file, creating it if needed. Returns false and leaves caching off if that fails
+    bool open(const char* directory, uint64_t seed, int terrainType, uint64_t paramsHash);
+    void close();
+
+    bool isOpen();
+
+    // Copies the decorated chunk into the world array if it's cached. The features come
+    // along because neighbours that aren't cached still need them to decorate
+    bool loadChunk(int chunkX, int chunkZ, uint8_t* world, World::ChunkFeatures& features);
+    void storeChunk(int chunkX, int chunkZ, const uint8_t* world, const World::ChunkFeatures& features);
+}